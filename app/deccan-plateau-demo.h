@@ -1,5 +1,8 @@
 #pragma once
 #include <GLFW/glfw3.h>
-const uint32_t WIDTH = 800;
-const uint32_t HEIGHT = 600;
-void MainLoop(GLFWwindow* window);
\ No newline at end of file
+#include "renderer.h"
+void MainLoop(GLFWwindow* window);
+/// <summary>
+/// Renders numberOfFrames frames without a window and prints how long it took.
+/// </summary>
+void HeadlessLoop(uint32_t numberOfFrames);
@@ -0,0 +1,591 @@
+#include "renderer.h"
+#include "vk/my-vk-extensions.h"
+#include "vk/my-vk-validationLayers.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <limits>
+#include "utils/object_namer.h"
+#include "entities/game-object.h"
+#include "entities/mesh.h"
+#include "entities/image.h"
+#include "io/mesh-load.h"
+#include "io/image-load.h"
+#include "utils/concatenate.h"
+#include "entities/pipeline.h"
+#include "gpu-picking/gpu-picker-pipeline.h"
+#include "entities/renderable.h"
+#include "entities/transform-store.h"
+#include "vk/my-instance.h"
+#include "vk/my-device.h"
+#include "vk/my-gpu-profiler.h"
+#include "utils/job-system.h"
+#include "entities/instance-batcher.h"
+#include "entities/frustum-culling.h"
+#include "entities/culling-pipeline.h"
+#include "entities/depth-pyramid.h"
+#include "entities/scene-bvh.h"
+#include "entities/ray-picking.h"
+#ifndef _WIN32
+#include <malloc.h>
+#endif
+
+std::map<std::string, entities::Mesh*> gMeshTable;
+entities::Pipeline* helloForSwapChain = nullptr;
+//entities::Pipeline* helloForRenderToTexture = nullptr;
+GpuPicker::GpuPickerPipeline* gpuPickerPipeline = nullptr;
+entities::RenderToTextureTargetManager* rttManager = nullptr;
+VkContext vkContext{};
+std::vector<entities::Renderable*> gRenderables{};
+PickingMode gPickingMode = PickingMode::Gpu;
+uint32_t gPickerReadbackSize = 1;
+entities::PickResult gPicked{};
+static myvk::Instance* instance = nullptr;
+static myvk::Device* device = nullptr;
+static io::ImageData* brickImageData = nullptr;
+static entities::GpuTextureManager* gpuTextureManager = nullptr;
+static entities::DepthBufferManager* depthBufferManager = nullptr;
+/// <summary>
+/// Name of the render to texture target that replaces the swap chain image when running headless
+/// </summary>
+const std::string HEADLESS_RENDER_PASS_TARGET = "headlessRenderPassTargetImage";
+static myvk::GpuProfiler* gpuProfiler = nullptr;
+static utils::JobSystem* jobSystem = nullptr;
+static entities::InstanceBatcher* instanceBatcher = nullptr;
+static entities::CullingPipeline* cullingPipeline = nullptr;
+static entities::DepthPyramid* depthPyramid = nullptr;
+/// <summary>
+/// The world bounds of gRenderables, for the spatial queries, and the renderable of each object
+/// id, nullptr for the ids that aren't in gRenderables. See UpdateSceneBvh.
+/// </summary>
+static entities::SceneBvh* sceneBvh = nullptr;
+static std::vector<entities::Renderable*> renderableOfId;
+static std::vector<uint32_t> newIds;
+/// <summary>
+/// The ids in the frustum in the current frame, and their renderables, kept to not allocate 
+/// every frame. See CullRenderables.
+/// </summary>
+static std::vector<uint32_t> visibleIds;
+static std::vector<entities::Renderable*> visibleRenderables;
+/// <summary>
+/// From this many renderables on the culling runs on the gpu, when the passes draw indirect, 
+/// with the occlusion culling. Below it the cpu culls faster than the dispatches, the depth
+/// pyramid and the split on-screen pass cost.
+/// </summary>
+const uint32_t GPU_CULLING_THRESHOLD = 16384;
+
+const char* VkSystemAllocationScopeToString(VkSystemAllocationScope s) {
+    switch (s) {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:
+            return "VK_SYSTEM_ALLOCATION_SCOPE_COMMAND";
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:
+            return "VK_SYSTEM_ALLOCATION_SCOPE_OBJECT";
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:
+            return "VK_SYSTEM_ALLOCATION_SCOPE_CACHE";
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:
+            return "VK_SYSTEM_ALLOCATION_SCOPE_DEVICE";
+        case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE:
+            return "VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE";
+        default:
+            return "INVALID VK SYSTEM ALLOCATION SCOPE";
+    }
+}
+void* myAllocationFunction(
+    void* pUserData,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope allocationScope) {
+    //TODO: Use some cool custom allocator
+#ifdef _WIN32
+    void* result = _aligned_malloc(size, alignment);//visual studio lacks std::aligned_alloc 
+#else
+    //posix_memalign refuses alignments below the size of a pointer, vulkan may ask for less
+    void* result = nullptr;
+    if (posix_memalign(&result, std::max(alignment, sizeof(void*)), size) != 0)
+        result = nullptr;
+#endif
+#ifdef PRINT_ALLOCATIONS 
+    printf("allocated %zu bytes with %zu alignment @%p for scope %s\n", size, alignment, result, 
+        VkSystemAllocationScopeToString( allocationScope ));
+#endif
+    return result;
+}
+
+void myFreeFunction(
+    void* pUserData,
+    void* pMemory) {
+    //TODO: Use some cool custom allocator
+#ifdef PRINT_ALLOCATIONS 
+    printf("deleting @%p\n", pMemory);
+#endif
+#ifdef _WIN32
+    _aligned_free(pMemory);
+#else
+    free(pMemory);
+#endif
+}
+
+void* myReallocationFunction(
+    void* pUserData,
+    void* pOriginal,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope allocationScope) {
+    // Implement custom reallocation logic
+    //size 0 is a free, like realloc
+    if (size == 0) {
+        myFreeFunction(pUserData, pOriginal);
+        return nullptr;
+    }
+#ifdef _WIN32
+    void* result = _aligned_realloc(pOriginal, size, alignment);
+#else
+    //there's no aligned realloc outside of msvc: allocate aligned, copy, free the old block
+    void* result = nullptr;
+    if (posix_memalign(&result, std::max(alignment, sizeof(void*)), size) != 0)
+        result = nullptr;
+    if (result != nullptr && pOriginal != nullptr) {
+        memcpy(result, pOriginal, std::min(size, malloc_usable_size(pOriginal)));
+        free(pOriginal);
+    }
+#endif
+    //TODO: Use some cool custom allocator
+#ifdef PRINT_ALLOCATIONS
+    printf("reallocated %zu bytes with %zu alignment from @%p to @%p for scope %d\n",
+        size, alignment, pOriginal, result, VkSystemAllocationScope(allocationScope));
+#endif
+    return result;
+}
+
+void InitRenderer(GLFWwindow* window)
+{
+    ///Vulkan initialization
+    
+    bool headless = window == nullptr;
+    instance = new myvk::Instance(window);
+    instance->ChoosePhysicalDevice(VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU, myvk::YES);
+    device = new myvk::Device(instance->GetPhysicalDevice(),
+        instance->GetInstance(), instance->GetSurface(), GetValidationLayerNames());
+    vkContext.headless = headless;
+    if (headless) {
+        //the offscreen target plays the role of the swap chain, it must be known before the
+        //on-screen render pass is created
+        vkContext.swapChainExtent = { WIDTH, HEIGHT };
+        vkContext.swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    }
+    else {
+        CreateSwapChain(vkContext);
+        CreateImageViewForSwapChain(vkContext);
+    }
+    //Crete the global descriptor sets, they are used by many pipelines.
+    CreateDescriptorSetLayoutForCamera(vkContext);
+    CreateDescriptorSetLayoutForObject(vkContext);
+    CreateDescriptorSetLayoutForSampler(vkContext);
+    //create the textures
+    brickImageData = io::LoadImage("brick.png");
+    brickImageData->name = "brick.png";
+    io::ImageData* blackBrickImageData = io::LoadImage("blackBrick.png");
+    blackBrickImageData->name = "blackBrick.png";
+    io::ImageData* floor01ImageData = io::LoadImage("floor01.jpg");
+    floor01ImageData->name = "floor01.jpg";
+    std::vector<io::ImageData*> gpuTextures{ brickImageData , blackBrickImageData, floor01ImageData };
+    gpuTextureManager = new entities::GpuTextureManager(gpuTextures);
+    //create the depth buffers
+    std::vector<entities::DepthBufferManager::DepthBufferCreationData> depthBuffersForMainRenderPass;
+    depthBuffersForMainRenderPass.push_back(
+        {WIDTH, HEIGHT, "mainRenderPassDepthBuffer"});
+    depthBuffersForMainRenderPass.push_back(
+        { WIDTH, HEIGHT, "helloOffscreenRenderPassDepthBuffer" }
+    );
+    depthBufferManager = new entities::DepthBufferManager( depthBuffersForMainRenderPass
+    );
+    //render pass depends upon the depth buffer
+    CreateSwapchainRenderPass(vkContext);
+    CreateRenderToTextureRenderPass(vkContext);
+    CreateHelloSampler(vkContext);
+    //because the uniform buffer pool relies on descriptor set layouts the layouts must be ready
+    //before the uniform buffer pool is created
+    entities::GameObjectUniformBufferPool::Initialize(&vkContext);
+    instanceBatcher = new entities::InstanceBatcher(&vkContext);
+    sceneBvh = new entities::SceneBvh();
+
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts = {
+        vkContext.helloCameraDescriptorSetLayout,//set 0
+        vkContext.helloObjectDescriptorSetLayout,//set 1
+        vkContext.helloSamplerDescriptorSetLayout //set 2
+    };
+    //the main difference between these 2 pipelines is that one renders to the swap chain, the other
+    //to a texture. That's because each of them uses a different render pass, and one render pass 
+    //goes to the swap chain and other to a texture.
+    helloForSwapChain = new entities::Pipeline(&vkContext, 
+        vkContext.mSwapchainRenderPass, 
+        descriptorSetLayouts,
+        "helloForSwapChain");
+    //helloForRenderToTexture = new entities::Pipeline(&vkContext, 
+    //    vkContext.mRenderToTextureRenderPass, 
+    //    descriptorSetLayouts,
+    //    "helloForRenderToTexture");
+    //
+    gpuPickerPipeline = new GpuPicker::GpuPickerPipeline(&vkContext,
+        vkContext.mRenderToTextureRenderPass,//TODO: Create a render pass for gpu picker
+        { vkContext.helloCameraDescriptorSetLayout, 
+          vkContext.helloObjectDescriptorSetLayout }, 
+        "gpuPickerPipeline");
+    //the occlusion culling reads what the on-screen pass drew
+    depthPyramid = new entities::DepthPyramid(
+        depthBufferManager->GetImage("mainRenderPassDepthBuffer"),
+        depthBufferManager->GetImageView("mainRenderPassDepthBuffer"),
+        WIDTH, HEIGHT, "mainDepthPyramid");
+    cullingPipeline = new entities::CullingPipeline(&vkContext,
+        vkContext.helloObjectDescriptorSetLayout,
+        vkContext.helloCameraDescriptorSetLayout,
+        depthPyramid,
+        "cullingPipeline");
+    
+        
+        
+    std::vector<entities::RenderToTextureTargetManager::RenderToTextureImageCreateData> renderToTextureImages = {
+        {
+        WIDTH, HEIGHT, VK_FORMAT_R8G8B8A8_UNORM ,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | 
+        VK_IMAGE_USAGE_SAMPLED_BIT |
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 
+        GpuPicker::GPU_PICKER_RENDER_PASS_TARGET
+        }
+    };
+    if (headless) {
+        renderToTextureImages.push_back({
+            WIDTH, HEIGHT, vkContext.swapChainImageFormat,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            HEADLESS_RENDER_PASS_TARGET
+        });
+    }
+    rttManager = new entities::RenderToTextureTargetManager(renderToTextureImages);
+    if (headless) {
+        //a swap chain of one image, that belongs to rttManager
+        vkContext.swapchainImages = { rttManager->GetImage(HEADLESS_RENDER_PASS_TARGET) };
+        vkContext.swapChainImageViews = { rttManager->GetImageView(HEADLESS_RENDER_PASS_TARGET) };
+    }
+
+    CreateFramebuffersForOnscreenRenderPass(vkContext, depthBufferManager->GetImageView("mainRenderPassDepthBuffer"));
+    CreateFramebuffersForRenderToTextureRenderPass(vkContext,
+        depthBufferManager->GetImageView("helloOffscreenRenderPassDepthBuffer"),
+        rttManager->GetImageView(GpuPicker::GPU_PICKER_RENDER_PASS_TARGET),
+        vkContext.mRenderToTextureRenderPass, WIDTH, HEIGHT);
+
+
+    CreateUniformBuffersForCamera(vkContext);
+    //CreateUniformBuffersForObject(vkContext);//For now it'll live here but when i have my game objects, it'll go to them
+    CreateDescriptorPool(vkContext);//for now i create  both pools at the same place. In the future i'll have some kind of pool manager
+    CreateDescriptorSetsForCamera(vkContext);
+    CreateDescriptorSetsForSampler(vkContext, gpuTextureManager, "floor01.jpg");
+    CreateCommandBuffer(vkContext);
+    CreateSyncObjects(vkContext);
+    gpuProfiler = new myvk::GpuProfiler();
+    //the thread that calls InitRenderer is the one that runs the frames, it becomes worker 0
+    jobSystem = new utils::JobSystem();
+}
+
+entities::Mesh* LoadMesh(const std::string& file)
+{
+    //Load the mesh from file to intermediary object, then to the gpu
+    std::shared_ptr<io::MeshData> meshFile = io::LoadMeshes(file)[0];
+    entities::Mesh* mesh = new entities::Mesh(meshFile, &vkContext);
+    gMeshTable.insert({ mesh->mName, mesh });
+    return mesh;
+}
+
+/// <summary>
+/// The transform update phase: computes the model matrix of each object that changed and 
+/// writes it to the frame's region of the object uniform pool. Every pass of the frame reuses it.
+/// Static objects keep the record written in a previous use of the frame slot.
+/// </summary>
+static void UpdateTransforms(uint32_t frame)
+{
+    gFrameStats.transformsUpdated += entities::TransformStore::Instance().Update(frame);
+}
+
+/// <summary>
+/// Fills renderableOfId from gRenderables, that anyone may change between frames. If updateTree
+/// is true it also brings the scene bvh up to date with them and with the world bounds the 
+/// transform update left: the renderables that are new get inserted, the ids that left 
+/// gRenderables get removed and the rest refitted. Frames that don't query the tree leave it
+/// behind, the next one that does catches up.
+/// </summary>
+static void UpdateSceneBvh(bool updateTree)
+{
+    const entities::TransformStore& store = entities::TransformStore::Instance();
+    renderableOfId.assign(store.Capacity(), nullptr);
+    for (entities::Renderable* renderable : gRenderables) {
+        renderableOfId[renderable->mId] = renderable;
+    }
+    if (!updateTree)
+        return;
+    const entities::BoundsArrays bounds = store.GetWorldBounds();
+    newIds.clear();
+    for (entities::Renderable* renderable : gRenderables) {
+        if (!sceneBvh->Contains(renderable->mId))
+            newIds.push_back(renderable->mId);
+    }
+    if (!newIds.empty())
+        sceneBvh->Insert(newIds, bounds);
+    //every renderable is in the tree, if it has more some were deleted
+    if (sceneBvh->Size() > gRenderables.size()) {
+        for (uint32_t id = 0; id < renderableOfId.size(); id++) {
+            if (renderableOfId[id] == nullptr)
+                sceneBvh->Remove(id);
+        }
+    }
+    sceneBvh->Refit(bounds);
+}
+
+/// <summary>
+/// Asks the scene bvh for what is in the camera's frustum and fills visibleRenderables with 
+/// the renderables that may be on screen. Both passes draw only those.
+/// </summary>
+static void CullRenderables(const entities::Frustum& frustum)
+{
+    visibleIds.clear();
+    sceneBvh->QueryFrustum(frustum, visibleIds);
+    visibleRenderables.clear();
+    for (uint32_t id : visibleIds) {
+        visibleRenderables.push_back(renderableOfId[id]);
+    }
+    gFrameStats.objectsCulled = static_cast<uint32_t>(gRenderables.size() - visibleRenderables.size());
+}
+
+/// <summary>
+/// True if the passes draw from the indirect buffer built by the batcher, a handful of calls per
+/// pass instead of one per batch. The instance ids need drawIndirectFirstInstance, and the per-draw
+/// gpu scopes need the draws one by one, so either turns it off.
+/// </summary>
+static bool UseIndirectDraws()
+{
+    return myvk::Device::gDevice->GetEnabledFeatures().drawIndirectFirstInstance && !gpuProfiler->mProfileDraws;
+}
+
+/// <summary>
+/// Records one instanced draw per batch with the pipeline, or the indirect draws of each page if 
+/// useIndirect is true. With gpu culling the indirect draws are those of the phases 
+/// [firstPhase, firstPhase + numberOfPhases).
+/// </summary>
+template<typename TPipeline>
+static void RecordDraws(TPipeline* pipeline, const std::vector<entities::InstanceBatch>& batches,
+    VkCommandBuffer cmd, bool useIndirect, uint32_t firstPhase = 0, uint32_t numberOfPhases = 1)
+{
+    const uint32_t frame = vkContext.currentFrame;
+    //the state every draw of the pass shares
+    pipeline->Bind(cmd);
+    instanceBatcher->Bind(cmd, frame);
+    entities::Mesh::BindGlobalMeshBuffer(cmd);
+    if (useIndirect) {
+        for (uint32_t phase = firstPhase; phase < firstPhase + numberOfPhases; phase++) {
+            const uint32_t commandOffset = instanceBatcher->GetPhaseCommandOffset(phase);
+            for (entities::IndirectDrawRange range : instanceBatcher->GetIndirectRanges()) {
+                range.firstCommand += commandOffset;
+                pipeline->DrawIndirect(range, instanceBatcher->GetIndirectBuffer(frame), cmd);
+            }
+        }
+        return;
+    }
+    entities::BoundDrawState bound;
+    for (const auto& batch : batches) {
+        pipeline->DrawBatch(batch, cmd, bound);
+    }
+}
+
+bool DrawFrame(CameraUniformBuffer& cameraBuffer, glm::vec2 mousePos)
+{
+    gFrameStats.Reset();
+    uint32_t imageIndex;
+    if (!BeginFrame(vkContext, imageIndex))
+        return false;
+    VkCommandBuffer currentCommand = vkContext.commandBuffers[vkContext.currentFrame];
+    gpuProfiler->BeginFrame(currentCommand, vkContext.currentFrame);
+    gFrameStats.gpuFrameMs = gpuProfiler->GetScopeMs(GPU_SCOPE_FRAME);
+    uint32_t frameScope = gpuProfiler->BeginScope(currentCommand, GPU_SCOPE_FRAME);
+    //camera and other per-frame data, written once and shared by all passes
+    UpdateFrameGlobals(vkContext, cameraBuffer);
+    UpdateTransforms(vkContext.currentFrame);
+    //the indirect draws are a few calls per pass, there's nothing to spread over threads
+    const bool useIndirect = UseIndirectDraws();
+    //the gpu culling only fills the indirect commands, the other paths need the cpu's
+    const bool useGpuCulling = useIndirect && gRenderables.size() >= GPU_CULLING_THRESHOLD;
+    const bool useGpuPicking = gPickingMode == PickingMode::Gpu;
+    //the tree is only for the cpu culling and the cpu picking
+    UpdateSceneBvh(!useGpuCulling || !useGpuPicking);
+    if (useGpuPicking) {
+        //the slot's fence was waited for, its region is from MAX_FRAMES_IN_FLIGHT frames ago.
+        //The id may be of an object that is gone by now.
+        const uint32_t pickedId = gpuPickerPipeline->GetRegion(vkContext.currentFrame).ClosestId();
+        gPicked = entities::PickResult{};
+        if (pickedId < renderableOfId.size() && renderableOfId[pickedId] != nullptr)
+            gPicked.objectId = pickedId;
+    }
+    else {
+        //no copy for this slot, don't leave it with the region of the last gpu picking frame
+        gpuPickerPipeline->ClearRegion(vkContext.currentFrame);
+    }
+    //the same planes for the cpu and the gpu culling
+    const entities::Frustum frustum = entities::ExtractFrustum(cameraBuffer.proj * cameraBuffer.view);
+    if (!useGpuCulling)
+        CullRenderables(frustum);
+    //renderables that share a mesh are drawn together, both passes use the same batches. 
+    //After the transforms so that the depth in the sort keys is this frame's.
+    const std::vector<entities::InstanceBatch>& batches = instanceBatcher->Build(vkContext.currentFrame, 
+        useGpuCulling ? gRenderables : visibleRenderables, cameraBuffer.view, useGpuCulling);
+    if (useGpuCulling) {
+        //outside of the render passes: last frame's visible objects that are still visible
+        SetMark({ 0.1f, 0.3f, 0.8f }, "GpuCulling", currentCommand, vkContext);
+        uint32_t cullingScope = gpuProfiler->BeginScope(currentCommand, GPU_SCOPE_CULLING);
+        cullingPipeline->Record(currentCommand, *instanceBatcher, frustum, 0);
+        gpuProfiler->EndScope(currentCommand, cullingScope);
+        EndMark(currentCommand);
+    }
+    //begins the on-screen render pass. With the gpu culling it's split in two, the second half
+    //draws what the occlusion culling finds behind the depth of the first.
+    SetMark({ 0.2f, 0.8f, 0.1f }, "OnScreenRenderPass", currentCommand, vkContext);
+    uint32_t onScreenScope = gpuProfiler->BeginScope(currentCommand, GPU_SCOPE_ON_SCREEN_PASS);
+    std::array<VkClearValue, 2> onscreenClearValues{};
+    onscreenClearValues[0].color = { {1.0f, 0.0f, 0.0f, 1.0f} };
+    onscreenClearValues[1].depthStencil = { 1.0f, 0 };
+    const VkRenderPass onScreenRenderPass = useGpuCulling ? 
+        vkContext.mSwapchainFirstPhaseRenderPass : vkContext.mSwapchainRenderPass;
+    BeginRenderPass(onScreenRenderPass,
+        vkContext.swapChainFramebuffers[imageIndex],
+        currentCommand,
+        vkContext.swapChainExtent,
+        onscreenClearValues
+    );
+    RecordDraws(helloForSwapChain, batches, currentCommand, useIndirect);
+    //end the on-screen render pass
+    vkCmdEndRenderPass(currentCommand);
+    if (useGpuCulling) {
+        //the pyramid of what was drawn, then everything else is tested against it
+        uint32_t occlusionScope = gpuProfiler->BeginScope(currentCommand, GPU_SCOPE_OCCLUSION_CULLING);
+        depthPyramid->Record(currentCommand);
+        cullingPipeline->Record(currentCommand, *instanceBatcher, frustum, 1);
+        gpuProfiler->EndScope(currentCommand, occlusionScope);
+        BeginRenderPass(vkContext.mSwapchainSecondPhaseRenderPass,
+            vkContext.swapChainFramebuffers[imageIndex],
+            currentCommand,
+            vkContext.swapChainExtent,
+            onscreenClearValues
+        );
+        RecordDraws(helloForSwapChain, batches, currentCommand, useIndirect, 1);
+        vkCmdEndRenderPass(currentCommand);
+    }
+    EndMark(currentCommand);
+    gpuProfiler->EndScope(currentCommand, onScreenScope);
+    if (useGpuPicking) {
+        //begin the offscreen render pass to draw the objs for picking
+        SetMark({ 0.8f, 0.1f, 0.3f }, "RenderToTextureRenderPass", currentCommand, vkContext);
+        uint32_t pickerScope = gpuProfiler->BeginScope(currentCommand, GPU_SCOPE_PICKER_PASS);
+        std::array<VkClearValue, 2> offscreenClearValues{};
+        offscreenClearValues[0].color = { {1.0f, 1.0f, 1.0f, 1.0f} };
+        offscreenClearValues[1].depthStencil = { 1.0f, 0 };
+        BeginRenderPass(vkContext.mRenderToTextureRenderPass,
+            vkContext.mRTTFramebuffer,
+            currentCommand,
+            vkContext.swapChainExtent,
+            offscreenClearValues
+        );
+        //both phases of the gpu culling at once, the picker's depth isn't used for the culling
+        RecordDraws(gpuPickerPipeline, batches, currentCommand, useIndirect, 0,
+            useGpuCulling ? entities::GPU_CULLING_PHASES : 1);
+        //end the offscreen render pass
+        vkCmdEndRenderPass(currentCommand);
+        gpuProfiler->EndScope(currentCommand, pickerScope);
+        //schedule the copy of the pixels around the cursor. They won't be available until the
+        //frame's slot comes around again
+        uint32_t copyScope = gpuProfiler->BeginScope(currentCommand, GPU_SCOPE_PICKER_COPY);
+        gpuPickerPipeline->SetReadbackSize(gPickerReadbackSize);
+        gpuPickerPipeline->ScheduleTransferImageFromGPUtoCPU(currentCommand,
+            rttManager->GetImage(GpuPicker::GPU_PICKER_RENDER_PASS_TARGET),
+            WIDTH, HEIGHT, static_cast<int32_t>(std::floor(mousePos.x)), static_cast<int32_t>(std::floor(mousePos.y)),
+            vkContext.currentFrame);
+        gpuProfiler->EndScope(currentCommand, copyScope);
+    }
+    //end the frame
+    EndMark(currentCommand);
+    gpuProfiler->EndScope(currentCommand, frameScope);
+    gpuProfiler->EndFrame();
+    EndFrame(vkContext, imageIndex);
+    if (!useGpuPicking) {
+        //the transforms and the bvh are this frame's, the ray goes through the same scene that
+        //was drawn
+        const entities::Ray ray = entities::RayThroughPixel(cameraBuffer.view, cameraBuffer.proj, mousePos,
+            glm::vec2(vkContext.swapChainExtent.width, vkContext.swapChainExtent.height));
+        gPicked = entities::PickObject(*sceneBvh, ray, std::numeric_limits<float>::infinity(),
+            [](uint32_t id) -> const entities::Mesh* {
+                return renderableOfId[id] != nullptr ? renderableOfId[id]->mMesh : nullptr;
+            });
+    }
+    return true;
+}
+
+void DestroyRenderer()
+{
+    //cleanup
+    vkDeviceWaitIdle(myvk::Device::gDevice->GetDevice());
+    delete gpuPickerPipeline;
+    delete cullingPipeline;
+    delete depthPyramid;
+    delete helloForSwapChain;
+    delete rttManager;
+    delete brickImageData;
+    delete gpuTextureManager;
+    DestroyDescriptorSets(vkContext);
+    DestroyPipeline(vkContext);
+    DestroyPipelineLayout(vkContext);
+    DestroyFramebuffers(vkContext);
+    DestroySwapchainRenderPass(vkContext);
+    DestroySwapChain(vkContext);
+    DestroyImageViews(vkContext);
+    DestroySyncObjects(vkContext);
+
+    vkFreeCommandBuffers(device->GetDevice(), device->GetCommandPool(), 
+        static_cast<uint32_t>(vkContext.commandBuffers.size()), vkContext.commandBuffers.data());
+    vkDestroyFramebuffer(device->GetDevice(), vkContext.mRTTFramebuffer, nullptr);
+    vkDestroyRenderPass(device->GetDevice(), vkContext.mRenderToTextureRenderPass, nullptr);
+    vkDestroySampler(device->GetDevice(), vkContext.helloSampler, nullptr);
+    vkDestroyDescriptorPool(device->GetDevice(), vkContext.helloSamplerDescriptorPool, nullptr);
+    //vkDestroyDescriptorSetLayout(device->GetDevice(), vkContext.helloCameraDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device->GetDevice(), vkContext.helloObjectDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device->GetDevice(), vkContext.helloSamplerDescriptorSetLayout, nullptr);
+    delete gpuProfiler;
+    gpuProfiler = nullptr;
+    delete jobSystem;
+    jobSystem = nullptr;
+    
+    for (auto go : gRenderables) {
+        delete go;
+    }
+    gRenderables.clear();
+    entities::GameObjectUniformBufferPool::Destroy();
+    delete instanceBatcher;
+    instanceBatcher = nullptr;
+    delete sceneBvh;
+    sceneBvh = nullptr;
+    renderableOfId.clear();
+    for (auto& kv : gMeshTable) {
+        delete kv.second;
+        kv.second = nullptr;
+    }
+    gMeshTable.clear();
+    delete depthBufferManager;
+    vkContext.DestroyCameraBuffer(vkContext);
+    //DestroyLogicalDevice(vkContext);
+    //DestroySurface(vkContext);
+    //DestroyDebugMessenger(vkContext.instance, vkContext.debugMessenger, vkContext.customAllocators);
+    //DestroyVkInstance(vkContext.instance, vkContext.customAllocators);
+    delete device;
+    delete instance;
+    device = nullptr;
+    instance = nullptr;
+}
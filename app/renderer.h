@@ -0,0 +1,73 @@
+#pragma once
+#include <GLFW/glfw3.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vk/my-vk.h"
+#include "utils/frame-stats.h"
+#include "entities/ray-picking.h"
+namespace entities {
+    class Mesh;
+    class Renderable;
+}
+const uint32_t WIDTH = 800;
+const uint32_t HEIGHT = 600;
+extern VkContext vkContext;
+/// <summary>
+/// Names of the gpu profiler scopes that DrawFrame records, see myvk::GpuProfiler::GetScopeMs
+/// </summary>
+const std::string GPU_SCOPE_FRAME = "Frame";
+const std::string GPU_SCOPE_ON_SCREEN_PASS = "OnScreenRenderPass";
+const std::string GPU_SCOPE_PICKER_PASS = "GpuPickerRenderPass";
+const std::string GPU_SCOPE_PICKER_COPY = "GpuPickerImageCopy";
+const std::string GPU_SCOPE_CULLING = "GpuCulling";
+const std::string GPU_SCOPE_OCCLUSION_CULLING = "GpuOcclusionCulling";
+/// <summary>
+/// Meshes loaded with LoadMesh, by mesh name. The renderer owns them.
+/// </summary>
+extern std::map<std::string, entities::Mesh*> gMeshTable;
+/// <summary>
+/// Everything that is drawn by DrawFrame. The renderer owns the objects in here and
+/// deletes what is left in DestroyRenderer.
+/// </summary>
+extern std::vector<entities::Renderable*> gRenderables;
+/// <summary>
+/// How DrawFrame finds the object under the cursor. Gpu draws the ids to an offscreen image
+/// and reads back the pixel, Cpu casts a ray through the scene bvh and the triangles of the
+/// meshes and skips the picker pass.
+/// </summary>
+enum class PickingMode { Gpu, Cpu };
+extern PickingMode gPickingMode;
+/// <summary>
+/// Side of the square of pixels around the cursor that the gpu picking reads back, in
+/// [1, GpuPicker::MAX_READBACK_SIZE]. Above 1 the closest object to the cursor in the square is
+/// picked, see GpuPicker::PickerRegion::ClosestId.
+/// </summary>
+extern uint32_t gPickerReadbackSize;
+/// <summary>
+/// What was under the cursor in the last frame DrawFrame drew. The gpu picking doesn't wait for
+/// its readback, its result is for the cursor of MAX_FRAMES_IN_FLIGHT frames ago.
+/// </summary>
+extern entities::PickResult gPicked;
+/// <summary>
+/// Creates the whole vulkan infrastructure: instance, device, swap chain, render passes,
+/// pipelines, buffers and sync objects. If window is nullptr the renderer is headless and
+/// the on-screen pass renders to an offscreen image.
+/// </summary>
+void InitRenderer(GLFWwindow* window);
+/// <summary>
+/// Loads the first mesh of an asset file, uploads it to the gpu and registers it in gMeshTable.
+/// </summary>
+entities::Mesh* LoadMesh(const std::string& file);
+/// <summary>
+/// Records and submits one frame: the on-screen pass and the picking, see gPickingMode.
+/// Returns false if the frame was skipped (ex: minimized window).
+/// Fills gFrameStats and gPicked.
+/// </summary>
+bool DrawFrame(CameraUniformBuffer& cameraBuffer, glm::vec2 mousePos);
+/// <summary>
+/// Waits for the gpu and destroys everything InitRenderer created, plus the meshes and the
+/// renderables.
+/// </summary>
+void DestroyRenderer();
@@ -0,0 +1,150 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "entities/frustum-culling.h"
+#include "entities/scene-bvh.h"
+#include "io/mesh-data.h"
+#include "utils/job-system.h"
+//Times the scene bvh on N spheres scattered in a cube: the SAH build, the refit when a part of
+//the objects moves a little every frame, and the queries against the linear SIMD culling of
+//every sphere. No vulkan needed, the spheres live in plain arrays laid out like the
+//TransformStore's world bounds.
+//Then the triangle bvh of a sphere mesh as dense as the 16 bit indices allow: the build in one
+//thread and over the job system, and the rays.
+
+template<typename F>
+static double MeasureMs(uint32_t iterations, F&& f)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+        f(i);
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count() / iterations;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t numberOfObjects = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 100000;
+    uint32_t iterations = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 100;
+    //the percentage of objects that move each frame
+    uint32_t movingPercent = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 10;
+    //the SIMD culling reads whole blocks of 4
+    const uint32_t paddedCount = (numberOfObjects + 3) & ~3u;
+    const float side = std::cbrt(static_cast<float>(numberOfObjects)) * 4.0f;
+    std::vector<float> x(paddedCount), y(paddedCount), z(paddedCount), radius(paddedCount);
+    srand(42);
+    for (uint32_t i = 0; i < numberOfObjects; i++) {
+        x[i] = rand() / static_cast<float>(RAND_MAX) * side;
+        y[i] = rand() / static_cast<float>(RAND_MAX) * side;
+        z[i] = rand() / static_cast<float>(RAND_MAX) * side;
+        radius[i] = 0.5f + rand() % 100 * 0.01f;
+    }
+    const entities::BoundsArrays bounds{ x.data(), y.data(), z.data(), radius.data() };
+
+    entities::SceneBvh bvh;
+    //one by one, then all at once into an empty tree, that builds it
+    double insertMs = MeasureMs(1, [&](uint32_t) {
+        for (uint32_t i = 0; i < numberOfObjects; i++)
+            bvh.Insert(i, glm::vec3(x[i], y[i], z[i]), radius[i]);
+    });
+    for (uint32_t i = 0; i < numberOfObjects; i++)
+        bvh.Remove(i);
+    std::vector<uint32_t> allIds(numberOfObjects);
+    for (uint32_t i = 0; i < numberOfObjects; i++)
+        allIds[i] = i;
+    double buildMs = MeasureMs(1, [&](uint32_t) { bvh.Insert(allIds, bounds); });
+    //the moving objects go around small circles, a few hundredths of their radius per frame
+    const uint32_t numberOfMoving = numberOfObjects / 100 * movingPercent;
+    uint32_t moved = 0;
+    double refitMs = MeasureMs(iterations, [&](uint32_t frame) {
+        const float angle = frame * 0.05f;
+        for (uint32_t i = 0; i < numberOfMoving; i++) {
+            x[i] += std::cos(angle) * 0.02f;
+            y[i] += std::sin(angle) * 0.02f;
+        }
+        moved += bvh.Refit(bounds);
+    });
+    double staticRefitMs = MeasureMs(iterations, [&](uint32_t) { bvh.Refit(bounds); });
+
+    //a camera in a corner looking at the middle, it sees part of the cube
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(side * 0.5f), glm::vec3(0.0f, 0.0f, 1.0f));
+    const glm::mat4 proj = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, side);
+    const entities::Frustum frustum = entities::ExtractFrustum(proj * view);
+    std::vector<uint8_t> visible(paddedCount);
+    uint32_t linearVisible = 0;
+    double linearMs = MeasureMs(iterations, [&](uint32_t) {
+        linearVisible = entities::CullSpheresSimd(frustum, bounds, 0, numberOfObjects, visible.data());
+    });
+    std::vector<uint32_t> ids;
+    double frustumMs = MeasureMs(iterations, [&](uint32_t) {
+        ids.clear();
+        bvh.QueryFrustum(frustum, ids);
+    });
+    const size_t bvhVisible = ids.size();
+    //rays from the corner towards random points of the far faces
+    uint32_t hits = 0;
+    double rayMs = MeasureMs(iterations, [&](uint32_t i) {
+        const entities::Ray ray{ glm::vec3(0.0f),
+            glm::normalize(glm::vec3(side, (i * 37 % 100) * 0.01f * side, (i * 61 % 100) * 0.01f * side)) };
+        float distance;
+        hits += bvh.CastRay(ray, side * 2.0f, nullptr, distance) != entities::NO_OBJECT ? 1 : 0;
+    });
+    double boxMs = MeasureMs(iterations, [&](uint32_t i) {
+        const glm::vec3 corner(glm::vec3((i * 13 % 100) * 0.01f * side));
+        ids.clear();
+        bvh.QueryBox({ corner, corner + 10.0f }, ids);
+    });
+
+    printf("%u objects, %u iterations, %u%% moving\n", numberOfObjects, iterations, movingPercent);
+    printf("  incremental inserts: %8.3f ms\n", insertMs);
+    printf("  SAH build:           %8.3f ms\n", buildMs);
+    printf("  refit, moving:       %8.3f ms/frame (%.0f leaves moved per frame)\n", refitMs,
+        moved / static_cast<double>(iterations));
+    printf("  refit, static:       %8.3f ms/frame\n", staticRefitMs);
+    printf("  frustum, linear:     %8.3f ms (%u visible)\n", linearMs, linearVisible);
+    printf("  frustum, bvh:        %8.3f ms (%zu visible)\n", frustumMs, bvhVisible);
+    printf("  closest ray hit:     %8.3f ms (%u of %u rays hit)\n", rayMs, hits, iterations);
+    printf("  box query:           %8.3f ms\n", boxMs);
+
+    //a uv sphere of 255 x 255 vertices, ~130k triangles
+    const uint32_t rings = 255;
+    io::MeshData sphere;
+    for (uint32_t r = 0; r < rings; r++) {
+        for (uint32_t s = 0; s < rings; s++) {
+            const float theta = 3.14159265f * r / (rings - 1);
+            const float phi = 2.0f * 3.14159265f * s / (rings - 1);
+            sphere.vertices.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+        }
+    }
+    for (uint32_t r = 0; r + 1 < rings; r++) {
+        for (uint32_t s = 0; s + 1 < rings; s++) {
+            const uint16_t a = static_cast<uint16_t>(r * rings + s);
+            const uint16_t b = static_cast<uint16_t>(a + rings);
+            sphere.indices.insert(sphere.indices.end(), { a, b, static_cast<uint16_t>(a + 1), static_cast<uint16_t>(a + 1), b, static_cast<uint16_t>(b + 1) });
+        }
+    }
+    double serialBuildMs = MeasureMs(10, [&](uint32_t) { sphere.bvh.Build(sphere); });
+    double parallelBuildMs;
+    {
+        utils::JobSystem jobSystem;
+        parallelBuildMs = MeasureMs(10, [&](uint32_t) { sphere.bvh.Build(sphere); });
+    }
+    //from outside towards random points near the center
+    uint32_t triangleHits = 0;
+    double triangleRayMs = MeasureMs(iterations * 100, [&](uint32_t i) {
+        const glm::vec3 origin(3.0f, (i * 37 % 100) * 0.01f - 0.5f, (i * 61 % 100) * 0.01f - 0.5f);
+        const glm::vec3 target((i * 17 % 100) * 0.002f, (i * 29 % 100) * 0.002f, (i * 43 % 100) * 0.002f);
+        io::TriangleHit hit;
+        triangleHits += sphere.bvh.Intersect(sphere, origin, glm::normalize(target - origin), 10.0f, hit) ? 1 : 0;
+    });
+    printf("%zu triangles, %u bvh nodes\n", sphere.indices.size() / 3, sphere.bvh.NumberOfNodes());
+    printf("  build, 1 thread:     %8.3f ms\n", serialBuildMs);
+    printf("  build, job system:   %8.3f ms\n", parallelBuildMs);
+    printf("  closest triangle:    %8.5f ms (%u of %u rays hit)\n", triangleRayMs, triangleHits, iterations * 100);
+    return 0;
+}
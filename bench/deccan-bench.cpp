@@ -0,0 +1,381 @@
+#include "app/renderer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "entities/mesh.h"
+#include "entities/renderable.h"
+#include "vk/my-device.h"
+#include "vk/my-gpu-profiler.h"
+/// <summary>
+/// Benchmark options, from the command line.
+/// </summary>
+struct BenchOptions {
+    std::vector<uint32_t> objectCounts{ 1, 100, 1000, 10000, 100000 };
+    uint32_t warmupFrames = 60;
+    uint32_t measuredFrames = 500;
+    std::string csvFile = "";
+    std::string jsonFile = "";
+    /// <summary>
+    /// Wrap each draw in a gpu profiler scope. Makes the frame slower, use it to find costly draws.
+    /// </summary>
+    bool profileDraws = false;
+    /// <summary>
+    /// Fraction, in [0,1], of the objects that rotate every frame. The others are static.
+    /// </summary>
+    float dynamicFraction = 0.0f;
+    /// <summary>
+    /// Pick with a ray cast on the cpu instead of the gpu picker pass, see PickingMode.
+    /// </summary>
+    bool cpuPicking = false;
+    /// <summary>
+    /// Side of the square the gpu picking reads back around the cursor, see gPickerReadbackSize.
+    /// </summary>
+    uint32_t pickRegion = 1;
+};
+/// <summary>
+/// Result of one scene. If the scene couldn't be built (ex: out of memory) skipped is
+/// true and error says why.
+/// </summary>
+struct SceneResult {
+    uint32_t numberOfObjects = 0;
+    bool skipped = false;
+    std::string error = "";
+    uint32_t frames = 0;
+    double cpuMsMean = 0;
+    double cpuMsP50 = 0;
+    double cpuMsP95 = 0;
+    double cpuMsP99 = 0;
+    double gpuMsMean = -1;
+    double gpuOnScreenPassMsMean = -1;
+    double gpuPickerPassMsMean = -1;
+    double gpuPickerCopyMsMean = -1;
+    double drawCallsMean = 0;
+    double transformsUpdatedMean = 0;
+    double pipelineBindsMean = 0;
+    double descriptorSetBindsMean = 0;
+    double meshBindsMean = 0;
+    double objectsCulledMean = 0;
+    double objectsOccludedMean = 0;
+};
+
+static void PrintUsage()
+{
+    printf("deccan-bench [--objects 1,100,1000] [--warmup N] [--frames N] [--csv file] [--json file] [--profile-draws] [--dynamic 0.1] [--cpu-picking] [--pick-region N]\n");
+}
+
+static std::vector<uint32_t> ParseObjectCounts(const char* str)
+{
+    std::vector<uint32_t> result;
+    std::string s(str);
+    size_t begin = 0;
+    while (begin < s.size()) {
+        size_t end = s.find(',', begin);
+        if (end == std::string::npos)
+            end = s.size();
+        if (end > begin)
+            result.push_back(static_cast<uint32_t>(strtoul(s.substr(begin, end - begin).c_str(), nullptr, 10)));
+        begin = end + 1;
+    }
+    return result;
+}
+
+static BenchOptions ParseOptions(int argc, char** argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--objects") == 0 && hasValue) {
+            options.objectCounts = ParseObjectCounts(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && hasValue) {
+            options.warmupFrames = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.measuredFrames = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--csv") == 0 && hasValue) {
+            options.csvFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+            options.jsonFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--dynamic") == 0 && hasValue) {
+            options.dynamicFraction = std::clamp(static_cast<float>(atof(argv[++i])), 0.0f, 1.0f);
+        }
+        else if (strcmp(argv[i], "--profile-draws") == 0) {
+            options.profileDraws = true;
+        }
+        else if (strcmp(argv[i], "--cpu-picking") == 0) {
+            options.cpuPicking = true;
+        }
+        else if (strcmp(argv[i], "--pick-region") == 0 && hasValue) {
+            options.pickRegion = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else {
+            PrintUsage();
+            exit(1);
+        }
+    }
+    return options;
+}
+/// <summary>
+/// Nearest-rank percentile. sortedValues must be sorted and not empty.
+/// </summary>
+static double Percentile(const std::vector<double>& sortedValues, double p)
+{
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sortedValues.size()));
+    rank = std::clamp<size_t>(rank, 1, sortedValues.size());
+    return sortedValues[rank - 1];
+}
+/// <summary>
+/// Deletes the objects of the previous scene. Waits for the gpu because the frames in flight
+/// may still be using their slots in the uniform buffer pool.
+/// </summary>
+static void ClearScene()
+{
+    vkDeviceWaitIdle(myvk::Device::gDevice->GetDevice());
+    for (auto go : gRenderables) {
+        delete go;
+    }
+    gRenderables.clear();
+}
+/// <summary>
+/// Lays out numberOfObjects renderables in a square grid on the xy plane, cycling through the
+/// meshes. Returns the half size of the grid, to fit the camera.
+/// </summary>
+static float BuildScene(uint32_t numberOfObjects, const std::vector<entities::Mesh*>& meshes)
+{
+    const float spacing = 3.0f;
+    uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(numberOfObjects))));
+    float halfSize = (side - 1) * spacing * 0.5f;
+    for (uint32_t i = 0; i < numberOfObjects; i++) {
+        std::string name = "obj" + std::to_string(i);
+        entities::Renderable* renderable = new entities::Renderable(&vkContext, name, meshes[i % meshes.size()]);
+        gRenderables.push_back(renderable);
+        glm::vec3 pos{ (i % side) * spacing - halfSize, (i / side) * spacing - halfSize, 0.0f };
+        renderable->SetPosition(pos);
+    }
+    return halfSize;
+}
+/// <summary>
+/// Camera looking at the grid from above, with the whole grid in the frustum.
+/// </summary>
+static CameraUniformBuffer CreateCamera(float halfSize)
+{
+    float distance = std::max(5.0f, halfSize * 2.5f);
+    CameraUniformBuffer cameraBuffer;
+    cameraBuffer.view = glm::lookAt(glm::vec3(distance * 0.5f, distance * 0.5f, distance),
+        glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    cameraBuffer.proj = glm::perspective(glm::radians(45.0f),
+        vkContext.swapChainExtent.width / (float)vkContext.swapChainExtent.height, 0.1f, distance * 4.0f);
+    //GOTCHA: GLM is for opengl, the y coords are inverted.
+    cameraBuffer.proj[1][1] *= -1;
+    return cameraBuffer;
+}
+
+/// <summary>
+/// Rotates the first numberOfDynamicObjects renderables, the scene's moving part. 
+/// </summary>
+static void AnimateScene(uint32_t numberOfDynamicObjects, uint32_t frameNumber)
+{
+    glm::quat orientation = glm::angleAxis(glm::radians(frameNumber * 1.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    for (uint32_t i = 0; i < numberOfDynamicObjects; i++) {
+        gRenderables[i]->SetOrientation(orientation);
+    }
+}
+/// <summary>
+/// Mean of the gpu times that are known. Gpu results arrive a few frames late and may be 
+/// missing, those are negative and ignored.
+/// </summary>
+struct GpuTimeAccumulator {
+    double sum = 0;
+    uint32_t samples = 0;
+    void Add(double ms) {
+        if (ms < 0)
+            return;
+        sum += ms;
+        samples++;
+    }
+    double Mean()const { return samples > 0 ? sum / samples : -1.0; }
+};
+
+static SceneResult RunScene(uint32_t numberOfObjects, const BenchOptions& options,
+    const std::vector<entities::Mesh*>& meshes)
+{
+    SceneResult result;
+    result.numberOfObjects = numberOfObjects;
+    float halfSize = 0;
+    try {
+        halfSize = BuildScene(numberOfObjects, meshes);
+    }
+    catch (const std::runtime_error& e) {
+        ClearScene();
+        result.skipped = true;
+        result.error = e.what();
+        return result;
+    }
+    CameraUniformBuffer cameraBuffer = CreateCamera(halfSize);
+    const glm::vec2 mousePos(WIDTH / 2, HEIGHT / 2);
+    const uint32_t numberOfDynamicObjects = static_cast<uint32_t>(numberOfObjects * options.dynamicFraction);
+    for (uint32_t i = 0; i < options.warmupFrames; i++) {
+        AnimateScene(numberOfDynamicObjects, i);
+        DrawFrame(cameraBuffer, mousePos);
+    }
+    std::vector<double> cpuMs;
+    cpuMs.reserve(options.measuredFrames);
+    GpuTimeAccumulator gpuFrame, gpuOnScreenPass, gpuPickerPass, gpuPickerCopy;
+    double drawCallsSum = 0;
+    double transformsUpdatedSum = 0;
+    double pipelineBindsSum = 0;
+    double descriptorSetBindsSum = 0;
+    double meshBindsSum = 0;
+    double objectsCulledSum = 0;
+    double objectsOccludedSum = 0;
+    const myvk::GpuProfiler* profiler = myvk::GpuProfiler::gGpuProfiler;
+    for (uint32_t i = 0; i < options.measuredFrames; i++) {
+        //moving the objects is the game's work, not the renderer's. It stays out of the measure.
+        AnimateScene(numberOfDynamicObjects, options.warmupFrames + i);
+        auto begin = std::chrono::high_resolution_clock::now();
+        DrawFrame(cameraBuffer, mousePos);
+        auto end = std::chrono::high_resolution_clock::now();
+        cpuMs.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+        gpuFrame.Add(gFrameStats.gpuFrameMs);
+        gpuOnScreenPass.Add(profiler->GetScopeMs(GPU_SCOPE_ON_SCREEN_PASS));
+        gpuPickerPass.Add(profiler->GetScopeMs(GPU_SCOPE_PICKER_PASS));
+        gpuPickerCopy.Add(profiler->GetScopeMs(GPU_SCOPE_PICKER_COPY));
+        drawCallsSum += gFrameStats.drawCalls.load();
+        transformsUpdatedSum += gFrameStats.transformsUpdated;
+        pipelineBindsSum += gFrameStats.pipelineBinds.load();
+        descriptorSetBindsSum += gFrameStats.descriptorSetBinds.load();
+        meshBindsSum += gFrameStats.meshBinds.load();
+        objectsCulledSum += gFrameStats.objectsCulled;
+        objectsOccludedSum += gFrameStats.objectsOccluded;
+    }
+    ClearScene();
+    result.frames = static_cast<uint32_t>(cpuMs.size());
+    if (cpuMs.empty())
+        return result;
+    double sum = 0;
+    for (double ms : cpuMs)
+        sum += ms;
+    std::sort(cpuMs.begin(), cpuMs.end());
+    result.cpuMsMean = sum / cpuMs.size();
+    result.cpuMsP50 = Percentile(cpuMs, 50);
+    result.cpuMsP95 = Percentile(cpuMs, 95);
+    result.cpuMsP99 = Percentile(cpuMs, 99);
+    result.gpuMsMean = gpuFrame.Mean();
+    result.gpuOnScreenPassMsMean = gpuOnScreenPass.Mean();
+    result.gpuPickerPassMsMean = gpuPickerPass.Mean();
+    result.gpuPickerCopyMsMean = gpuPickerCopy.Mean();
+    result.drawCallsMean = drawCallsSum / cpuMs.size();
+    result.transformsUpdatedMean = transformsUpdatedSum / cpuMs.size();
+    result.pipelineBindsMean = pipelineBindsSum / cpuMs.size();
+    result.descriptorSetBindsMean = descriptorSetBindsSum / cpuMs.size();
+    result.meshBindsMean = meshBindsSum / cpuMs.size();
+    result.objectsCulledMean = objectsCulledSum / cpuMs.size();
+    result.objectsOccludedMean = objectsOccludedSum / cpuMs.size();
+    return result;
+}
+
+static void WriteCsv(FILE* file, const std::vector<SceneResult>& results)
+{
+    fprintf(file, "objects,status,frames,cpu_ms_mean,cpu_ms_p50,cpu_ms_p95,cpu_ms_p99,gpu_ms_mean,"
+        "gpu_on_screen_pass_ms,gpu_picker_pass_ms,gpu_picker_copy_ms,draw_calls,transforms_updated,"
+        "pipeline_binds,descriptor_set_binds,mesh_binds,objects_culled,objects_occluded\n");
+    for (const auto& r : results) {
+        if (r.skipped) {
+            fprintf(file, "%u,skipped,0,,,,,,,,,,,,,,,\n", r.numberOfObjects);
+            continue;
+        }
+        fprintf(file, "%u,ok,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", r.numberOfObjects, r.frames,
+            r.cpuMsMean, r.cpuMsP50, r.cpuMsP95, r.cpuMsP99, r.gpuMsMean,
+            r.gpuOnScreenPassMsMean, r.gpuPickerPassMsMean, r.gpuPickerCopyMsMean, r.drawCallsMean,
+            r.transformsUpdatedMean, r.pipelineBindsMean, r.descriptorSetBindsMean, r.meshBindsMean,
+            r.objectsCulledMean, r.objectsOccludedMean);
+    }
+}
+
+static void WriteJson(FILE* file, const std::vector<SceneResult>& results)
+{
+    fprintf(file, "{\n  \"scenes\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        fprintf(file, "    {\"objects\": %u, ", r.numberOfObjects);
+        if (r.skipped) {
+            //the error comes from our own exceptions, it has no quotes to escape
+            fprintf(file, "\"status\": \"skipped\", \"error\": \"%s\"}", r.error.c_str());
+        }
+        else {
+            fprintf(file, "\"status\": \"ok\", \"frames\": %u, \"cpu_ms\": {\"mean\": %.4f, \"p50\": %.4f, "
+                "\"p95\": %.4f, \"p99\": %.4f}, \"gpu_ms\": {\"frame\": %.4f, \"on_screen_pass\": %.4f, "
+                "\"picker_pass\": %.4f, \"picker_copy\": %.4f}, \"draw_calls\": %.1f, \"transforms_updated\": %.1f, "
+                "\"state_changes\": {\"pipeline_binds\": %.1f, \"descriptor_set_binds\": %.1f, \"mesh_binds\": %.1f}, "
+                "\"objects_culled\": %.1f, \"objects_occluded\": %.1f}",
+                r.frames, r.cpuMsMean, r.cpuMsP50, r.cpuMsP95, r.cpuMsP99, r.gpuMsMean,
+                r.gpuOnScreenPassMsMean, r.gpuPickerPassMsMean, r.gpuPickerCopyMsMean, r.drawCallsMean,
+                r.transformsUpdatedMean, r.pipelineBindsMean, r.descriptorSetBindsMean, r.meshBindsMean,
+                r.objectsCulledMean, r.objectsOccludedMean);
+        }
+        fprintf(file, i + 1 < results.size() ? ",\n" : "\n");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+static void WriteFile(const std::string& path, void (*writer)(FILE*, const std::vector<SceneResult>&),
+    const std::vector<SceneResult>& results)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error("could not open " + path + " for writing");
+    }
+    writer(file, results);
+    fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options = ParseOptions(argc, argv);
+    //always headless, the window system would only add noise
+    InitRenderer(nullptr);
+    myvk::GpuProfiler::gGpuProfiler->mProfileDraws = options.profileDraws;
+    gPickingMode = options.cpuPicking ? PickingMode::Cpu : PickingMode::Gpu;
+    gPickerReadbackSize = options.pickRegion;
+    std::vector<entities::Mesh*> meshes{
+        LoadMesh("monkey.glb"),
+        LoadMesh("torus.glb"),
+        LoadMesh("colored_cube.glb")
+    };
+    std::vector<SceneResult> results;
+    for (uint32_t numberOfObjects : options.objectCounts) {
+        printf("scene with %u objects...\n", numberOfObjects);
+        SceneResult result = RunScene(numberOfObjects, options, meshes);
+        if (result.skipped) {
+            printf("  skipped: %s\n", result.error.c_str());
+        }
+        else {
+            printf("  cpu ms p50 %.3f p95 %.3f p99 %.3f, gpu ms %.3f (on-screen %.3f, picker %.3f, copy %.3f), %.0f draw calls, %.0f transforms updated, "
+                "binds: %.0f pipelines %.0f sets %.0f meshes, %.0f culled %.0f occluded\n",
+                result.cpuMsP50, result.cpuMsP95, result.cpuMsP99, result.gpuMsMean,
+                result.gpuOnScreenPassMsMean, result.gpuPickerPassMsMean, result.gpuPickerCopyMsMean,
+                result.drawCallsMean, result.transformsUpdatedMean,
+                result.pipelineBindsMean, result.descriptorSetBindsMean, result.meshBindsMean,
+                result.objectsCulledMean, result.objectsOccludedMean);
+        }
+        results.push_back(result);
+    }
+    WriteCsv(stdout, results);
+    if (!options.csvFile.empty())
+        WriteFile(options.csvFile, WriteCsv, results);
+    if (!options.jsonFile.empty())
+        WriteFile(options.jsonFile, WriteJson, results);
+    DestroyRenderer();
+    return 0;
+}
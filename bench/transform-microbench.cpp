@@ -0,0 +1,163 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "entities/game-object.h"
+#include "entities/transform-store.h"
+#include "utils/job-system.h"
+//Compares the ways of turning position + orientation into ObjectUniformBuffer records:
+//the per-object path (glm, one heap object at a time, like GameObject used to do), the SoA 
+//scalar kernel and the SoA SIMD kernel, then the SIMD kernel split over the job system with
+//more and more threads. No vulkan needed, the records go to plain memory 
+//with the same stride the object pool uses.
+//Last, a check of the TransformStore's hierarchy: removing a parent in the same frame its
+//children were attached must detach them all.
+
+/// <summary>
+/// Stride of the records, they are a std430 array in the pool.
+/// </summary>
+static const size_t RECORD_STRIDE = sizeof(entities::ObjectUniformBuffer);
+/// <summary>
+/// What each GameObject used to hold.
+/// </summary>
+struct AosTransform {
+    glm::vec3 position;
+    glm::quat orientation;
+};
+
+/// <summary>
+/// Ids 0..3, 1 parented and swept by an Update, then 2 and 3 parented and 0 removed before the
+/// next Update. Once 0 is given to a new object nobody may be its child.
+/// </summary>
+static bool CheckRemoveParentInSameFrame()
+{
+    entities::TransformStore& store = entities::TransformStore::Instance();
+    std::vector<entities::ObjectUniformBuffer> records(4);
+    auto addresses = [&](uint32_t id) {
+        std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT> result;
+        result.fill(reinterpret_cast<uintptr_t>(&records[id]));
+        return result;
+    };
+    for (uint32_t id = 0; id < 4; id++)
+        store.Add(id, addresses(id));
+    store.SetParent(1, 0);
+    store.Update(0);
+    store.SetParent(2, 0);
+    store.SetParent(3, 0);
+    store.Remove(0);
+    store.Add(0, addresses(0));
+    store.Update(1);
+    bool ok = true;
+    for (uint32_t id = 1; id < 4; id++)
+        ok = ok && store.GetParent(id) == entities::NO_PARENT;
+    printf("  remove a parent in the frame it got children: %s\n", ok ? "ok" : "FAILED");
+    for (uint32_t id = 0; id < 4; id++)
+        store.Remove(id);
+    return ok;
+}
+
+template<typename F>
+static double MeasureNsPerObject(uint32_t numberOfObjects, uint32_t iterations, F&& f)
+{
+    f();//warm up the caches and the page tables
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+        f();
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    return ns / (static_cast<double>(iterations) * numberOfObjects);
+}
+
+static float MaxDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, uint32_t numberOfObjects)
+{
+    float result = 0;
+    for (uint32_t i = 0; i < numberOfObjects; i++) {
+        const float* ma = reinterpret_cast<const float*>(a.data() + i * RECORD_STRIDE);
+        const float* mb = reinterpret_cast<const float*>(b.data() + i * RECORD_STRIDE);
+        for (int j = 0; j < 16; j++)
+            result = std::max(result, std::abs(ma[j] - mb[j]));
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t numberOfObjects = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 100000;
+    uint32_t iterations = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 100;
+    //the kernels read whole blocks of 4
+    const uint32_t paddedCount = (numberOfObjects + 3) & ~3u;
+    //random-ish transforms
+    std::vector<AosTransform*> aos;
+    std::vector<float> px(paddedCount), py(paddedCount), pz(paddedCount);
+    std::vector<float> qx(paddedCount), qy(paddedCount), qz(paddedCount), qw(paddedCount, 1.0f);
+    std::vector<float> sx(paddedCount, 1.0f), sy(paddedCount, 1.0f), sz(paddedCount, 1.0f);
+    srand(42);
+    for (uint32_t i = 0; i < numberOfObjects; i++) {
+        glm::vec3 pos(rand() % 1000 * 0.1f, rand() % 1000 * 0.1f, rand() % 1000 * 0.1f);
+        glm::vec3 axis = glm::normalize(glm::vec3(rand() % 100 + 1, rand() % 100, rand() % 100));
+        glm::quat orientation = glm::angleAxis(glm::radians(static_cast<float>(rand() % 360)), axis);
+        //heap allocated one by one, like the game objects
+        aos.push_back(new AosTransform{ pos, orientation });
+        px[i] = pos.x; py[i] = pos.y; pz[i] = pos.z;
+        qx[i] = orientation.x; qy[i] = orientation.y; qz[i] = orientation.z; qw[i] = orientation.w;
+    }
+    entities::TransformArrays arrays{ px.data(), py.data(), pz.data(),
+        qx.data(), qy.data(), qz.data(), qw.data(), sx.data(), sy.data(), sz.data() };
+    std::vector<uint8_t> referenceRecords(paddedCount * RECORD_STRIDE);
+    std::vector<uint8_t> scalarRecords(paddedCount * RECORD_STRIDE);
+    std::vector<uint8_t> simdRecords(paddedCount * RECORD_STRIDE);
+    std::vector<uintptr_t> scalarDestinations(paddedCount), simdDestinations(paddedCount);
+    for (uint32_t i = 0; i < paddedCount; i++) {
+        scalarDestinations[i] = reinterpret_cast<uintptr_t>(scalarRecords.data() + i * RECORD_STRIDE);
+        simdDestinations[i] = reinterpret_cast<uintptr_t>(simdRecords.data() + i * RECORD_STRIDE);
+    }
+
+    double perObjectNs = MeasureNsPerObject(numberOfObjects, iterations, [&]() {
+        for (uint32_t i = 0; i < numberOfObjects; i++) {
+            entities::ObjectUniformBuffer objBuffer;
+            objBuffer.model = glm::mat4(1.0f);
+            objBuffer.model *= glm::translate(glm::mat4(1.0f), aos[i]->position);
+            objBuffer.model *= glm::mat4_cast(aos[i]->orientation);
+            objBuffer.objectId = i;
+            memcpy(referenceRecords.data() + i * RECORD_STRIDE, &objBuffer, sizeof(objBuffer));
+        }
+    });
+    double scalarNs = MeasureNsPerObject(numberOfObjects, iterations, [&]() {
+        entities::ComposeModelMatricesScalar(arrays, 0, numberOfObjects, nullptr, 0, scalarDestinations.data());
+    });
+    double simdNs = MeasureNsPerObject(numberOfObjects, iterations, [&]() {
+        entities::ComposeModelMatricesSimd(arrays, 0, numberOfObjects, nullptr, 0, simdDestinations.data());
+    });
+
+    printf("%u objects, %u iterations, %zu bytes stride\n", numberOfObjects, iterations, RECORD_STRIDE);
+    printf("  per-object glm (AoS): %8.3f ns/object\n", perObjectNs);
+    printf("  SoA scalar kernel:    %8.3f ns/object (%.2fx)\n", scalarNs, perObjectNs / scalarNs);
+    printf("  SoA SIMD kernel:      %8.3f ns/object (%.2fx)\n", simdNs, perObjectNs / simdNs);
+    printf("  max difference to glm: scalar %g, simd %g\n",
+        MaxDifference(referenceRecords, scalarRecords, numberOfObjects),
+        MaxDifference(referenceRecords, simdRecords, numberOfObjects));
+    //the SIMD kernel over the job system, in ranges like TransformStore::Update
+    const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t threads = 1; ; threads = std::min(threads * 2, hardwareThreads)) {
+        utils::JobSystem jobSystem(threads);
+        double parallelNs = MeasureNsPerObject(numberOfObjects, iterations, [&]() {
+            jobSystem.ParallelFor(numberOfObjects, 4096, [&](uint32_t begin, uint32_t end) {
+                entities::ComposeModelMatricesSimd(arrays, begin, end - begin, nullptr, 0, simdDestinations.data());
+            });
+        });
+        printf("  SIMD kernel, %2u threads: %8.3f ns/object (%.2fx the single thread kernel)\n",
+            threads, parallelNs, simdNs / parallelNs);
+        if (threads == hardwareThreads)
+            break;
+    }
+    for (auto t : aos)
+        delete t;
+    return CheckRemoveParentInSameFrame() ? 0 : 1;
+}
@@ -8,4 +8,6 @@ IF NOT EXIST "%folder%" (
 glslc.exe %1\shaders\hello_shader.frag -o %1\build/shaders/hello_shader_frag.spv
 glslc.exe %1\shaders\hello_shader.vert -o %1\build/shaders/hello_shader_vert.spv
 glslc.exe %1\shaders\gpu_picker.frag -o %1\build/shaders/gpu_picker_frag.spv
-glslc.exe %1\shaders\gpu_picker.vert -o %1\build/shaders/gpu_picker_vert.spv
\ No newline at end of file
+glslc.exe %1\shaders\gpu_picker.vert -o %1\build/shaders/gpu_picker_vert.spv
+glslc.exe %1\shaders\gpu_culling.comp -o %1\build/shaders/gpu_culling_comp.spv
+glslc.exe %1\shaders\depth_pyramid.comp -o %1\build/shaders/depth_pyramid_comp.spv
@@ -0,0 +1,291 @@
+#include "culling-pipeline.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include "pipeline.h"
+#include "instance-batcher.h"
+#include "frustum-culling.h"
+#include "depth-pyramid.h"
+#include "transform-store.h"
+#include "game-object.h"
+#include "vk/my-vk.h"
+#include "vk/my-device.h"
+#include "utils/object_namer.h"
+#include "utils/concatenate.h"
+#include "utils/frame-stats.h"
+
+namespace entities {
+    /// <summary>
+    /// Invocations per workgroup, same as local_size_x in gpu_culling.comp.
+    /// </summary>
+    static const uint32_t CULLING_WORKGROUP_SIZE = 64;
+    /// <summary>
+    /// The set 0 bindings of gpu_culling.comp: the cull instances, the indirect commands, the
+    /// visible ids, the visibility, the counters and the depth pyramid.
+    /// </summary>
+    static const uint32_t CULLING_BINDINGS = 6;
+    static const uint32_t CULLING_STORAGE_BUFFER_BINDINGS = 5;
+    /// <summary>
+    /// Capacity of the visibility buffer the first time, it doubles from there.
+    /// </summary>
+    static const uint32_t INITIAL_VISIBILITY_CAPACITY = 1024;
+    /// <summary>
+    /// The counters of gpu_culling.comp: culled by the frustum, culled by the occlusion.
+    /// </summary>
+    static const uint32_t NUMBER_OF_COUNTERS = 2;
+    /// <summary>
+    /// Push constants of gpu_culling.comp, the frustum, the instances of one page and what the
+    /// occlusion test needs. At most 128 bytes, the least a device can take.
+    /// </summary>
+    struct CullingConstants {
+        glm::vec4 planes[6];
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint32_t phase;
+        uint32_t secondPhaseCommandOffset;
+        uint32_t depthWidth;
+        uint32_t depthHeight;
+        uint32_t pyramidLevels;
+    };
+
+    CullingPipeline::CullingPipeline(VkContext* ctx, VkDescriptorSetLayout objectDescriptorSetLayout,
+        VkDescriptorSetLayout cameraDescriptorSetLayout, const DepthPyramid* depthPyramid, 
+        const std::string& name) :mName(name), mCtx(ctx), mDepthPyramid(depthPyramid)
+    {
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        //set 0, the batcher's buffers, ours and the pyramid
+        std::array<VkDescriptorSetLayoutBinding, CULLING_BINDINGS> bindings{};
+        for (uint32_t i = 0; i < CULLING_BINDINGS; i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = i < CULLING_STORAGE_BUFFER_BINDINGS ?
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = CULLING_BINDINGS;
+        layoutInfo.pBindings = bindings.data();
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &mDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout for culling");
+        }
+        SET_NAME(mDescriptorSetLayout, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, Concatenate(name, "DescriptorSetLayout").c_str());
+        //one set per frame in flight
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSizes[0].descriptorCount = CULLING_STORAGE_BUFFER_BINDINGS * MAX_FRAMES_IN_FLIGHT;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[1].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create culling descriptor pool!");
+        }
+        SET_NAME(mDescriptorPool, VK_OBJECT_TYPE_DESCRIPTOR_POOL, Concatenate(name, "DescriptorPool").c_str());
+        std::array<VkDescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> layouts;
+        layouts.fill(mDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = mDescriptorPool;
+        allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+        allocInfo.pSetLayouts = layouts.data();
+        if (vkAllocateDescriptorSets(device, &allocInfo, mDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets for culling!");
+        }
+        //the counters are read by the cpu when the frame's slot comes around again
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+            const VkDeviceSize size = NUMBER_OF_COUNTERS * sizeof(uint32_t);
+            CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                mCounters[frame].buffer, mCounters[frame].memory, device);
+            SET_NAME(mCounters[frame].buffer, VK_OBJECT_TYPE_BUFFER, Concatenate(name, "Counters", frame).c_str());
+            vkMapMemory(device, mCounters[frame].memory, 0, size, 0, &mCounters[frame].address);
+            memset(mCounters[frame].address, 0, size);
+        }
+        //set 0 is the culling's, set 1 the page of the object pool, set 2 the camera
+        std::array<VkDescriptorSetLayout, 3> setLayouts = { mDescriptorSetLayout, objectDescriptorSetLayout,
+            cameraDescriptorSetLayout };
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(CullingConstants);
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+        SET_NAME(mPipelineLayout, VK_OBJECT_TYPE_PIPELINE_LAYOUT, Concatenate(name, "PipelineLayout").c_str());
+        VkShaderModule computeShaderModule = Pipeline::LoadShaderModule(device, "gpu_culling_comp.spv");
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = computeShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = mPipelineLayout;
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline!");
+        }
+        SET_NAME(mPipeline, VK_OBJECT_TYPE_PIPELINE, name.c_str());
+        vkDestroyShaderModule(device, computeShaderModule, nullptr);
+    }
+
+    CullingPipeline::~CullingPipeline()
+    {
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        vkDestroyPipeline(device, mPipeline, nullptr);
+        vkDestroyPipelineLayout(device, mPipelineLayout, nullptr);
+        //destroying the pool frees its sets
+        vkDestroyDescriptorPool(device, mDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, mDescriptorSetLayout, nullptr);
+        DestroyBuffer(mVisibility);
+        for (auto& counters : mCounters)
+            DestroyBuffer(counters);
+    }
+
+    void CullingPipeline::DestroyBuffer(CullingBuffer& buffer)
+    {
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        if (buffer.memory != VK_NULL_HANDLE) {
+            if (buffer.address != nullptr)
+                vkUnmapMemory(device, buffer.memory);
+            vkFreeMemory(device, buffer.memory, nullptr);
+        }
+        if (buffer.buffer != VK_NULL_HANDLE)
+            vkDestroyBuffer(device, buffer.buffer, nullptr);
+        buffer = CullingBuffer();
+    }
+
+    void CullingPipeline::ReserveVisibility(VkCommandBuffer cmd, uint32_t numberOfIds)
+    {
+        if (numberOfIds <= mVisibilityCapacity)
+            return;
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        if (mVisibility.buffer != VK_NULL_HANDLE) {
+            //the frame in flight may still read it. It only happens when the scene grows.
+            vkDeviceWaitIdle(device);
+            DestroyBuffer(mVisibility);
+        }
+        uint32_t capacity = std::max(INITIAL_VISIBILITY_CAPACITY, mVisibilityCapacity);
+        while (capacity < numberOfIds)
+            capacity *= 2;
+        const VkDeviceSize size = static_cast<VkDeviceSize>(capacity) * sizeof(uint32_t);
+        CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVisibility.buffer, mVisibility.memory, device);
+        SET_NAME(mVisibility.buffer, VK_OBJECT_TYPE_BUFFER, Concatenate(mName, "Visibility").c_str());
+        mVisibilityCapacity = capacity;
+        //nobody is visible, the second phase tests everything
+        vkCmdFillBuffer(cmd, mVisibility.buffer, 0, VK_WHOLE_SIZE, 0);
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    void CullingPipeline::UpdateDescriptorSet(uint32_t frame, const InstanceBatcher& batcher)
+    {
+        const std::array<VkBuffer, CULLING_STORAGE_BUFFER_BINDINGS> buffers = {
+            batcher.GetCullInstanceBuffer(frame),
+            batcher.GetIndirectBuffer(frame),
+            batcher.GetVisibleIdBuffer(frame),
+            mVisibility.buffer,
+            mCounters[frame].buffer };
+        std::array<VkDescriptorBufferInfo, CULLING_STORAGE_BUFFER_BINDINGS> bufferInfos{};
+        std::array<VkWriteDescriptorSet, CULLING_BINDINGS> writes{};
+        for (uint32_t i = 0; i < CULLING_STORAGE_BUFFER_BINDINGS; i++) {
+            bufferInfos[i].buffer = buffers[i];
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = mDescriptorSets[frame];
+            writes[i].dstBinding = i;
+            writes[i].dstArrayElement = 0;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].descriptorCount = 1;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+        VkDescriptorImageInfo pyramidInfo{};
+        pyramidInfo.sampler = mDepthPyramid->GetSampler();
+        pyramidInfo.imageView = mDepthPyramid->GetImageView();
+        pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        VkWriteDescriptorSet& pyramidWrite = writes[CULLING_STORAGE_BUFFER_BINDINGS];
+        pyramidWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        pyramidWrite.dstSet = mDescriptorSets[frame];
+        pyramidWrite.dstBinding = CULLING_STORAGE_BUFFER_BINDINGS;
+        pyramidWrite.dstArrayElement = 0;
+        pyramidWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        pyramidWrite.descriptorCount = 1;
+        pyramidWrite.pImageInfo = &pyramidInfo;
+        vkUpdateDescriptorSets(myvk::Device::gDevice->GetDevice(), CULLING_BINDINGS, writes.data(), 0, nullptr);
+    }
+
+    void CullingPipeline::Record(VkCommandBuffer cmd, const InstanceBatcher& batcher, const Frustum& frustum,
+        uint32_t phase)
+    {
+        const uint32_t frame = mCtx->currentFrame;
+        if (phase == 0) {
+            //the frame's fence was waited on: the counts of the last frame on this slot are in, 
+            //and nobody is reading the set
+            uint32_t* counters = static_cast<uint32_t*>(mCounters[frame].address);
+            gFrameStats.objectsCulled = counters[0];
+            gFrameStats.objectsOccluded = counters[1];
+            counters[0] = counters[1] = 0;
+            ReserveVisibility(cmd, TransformStore::Instance().Capacity());
+            UpdateDescriptorSet(frame, batcher);
+        }
+        //the visibility was written by the phase before, this frame's or the last one's
+        VkMemoryBarrier visibilityBarrier{};
+        visibilityBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        visibilityBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        visibilityBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &visibilityBarrier, 0, nullptr, 0, nullptr);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout,
+            0, 1, &mDescriptorSets[frame], 0, nullptr);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout,
+            2, 1, &mCtx->helloCameraDescriptorSets[frame], 0, nullptr);
+        gFrameStats.pipelineBinds.fetch_add(1, std::memory_order_relaxed);
+        gFrameStats.descriptorSetBinds.fetch_add(2, std::memory_order_relaxed);
+        CullingConstants constants;
+        for (uint32_t p = 0; p < 6; p++)
+            constants.planes[p] = frustum.planes[p];
+        constants.phase = phase;
+        constants.secondPhaseCommandOffset = batcher.GetPhaseCommandOffset(1);
+        constants.depthWidth = mDepthPyramid->GetDepthWidth();
+        constants.depthHeight = mDepthPyramid->GetDepthHeight();
+        constants.pyramidLevels = mDepthPyramid->GetNumberOfLevels();
+        const uint32_t dynamicOffset = GameObjectUniformBufferPool::FrameOffset(frame);
+        for (const auto& range : batcher.GetIndirectRanges()) {
+            //the records of the page's objects, set 1
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout,
+                1, 1, &range.objectDescriptorSet, 1, &dynamicOffset);
+            gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+            constants.firstInstance = range.firstInstance;
+            constants.instanceCount = range.instanceCount;
+            vkCmdPushConstants(cmd, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullingConstants), &constants);
+            vkCmdDispatch(cmd, (range.instanceCount + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE, 1, 1);
+        }
+        //the draws read the instance counts, the vertex input reads the visible ids and the cpu
+        //reads the counters when the slot comes around
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+            VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+}
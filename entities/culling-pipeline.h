@@ -0,0 +1,84 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <array>
+#include <string>
+struct VkContext;
+namespace entities {
+    class InstanceBatcher;
+    class DepthPyramid;
+    struct Frustum;
+    /// <summary>
+    /// Culls the instances of an InstanceBatcher on the gpu with a compute shader, gpu_culling.comp.
+    /// Each invocation takes one CullInstance, moves the mesh's bounding sphere to the world with
+    /// the model matrix of the object's record and tests it against the frustum, then against the
+    /// depth pyramid. The visible ones bump the instance count of their batch's indirect command
+    /// and write their id in the batch's part of the visible id buffer, so the indirect draws 
+    /// only draw those.
+    /// The occlusion test runs in two phases. The first takes the objects that were visible in the
+    /// last frame and tests them against the pyramid that frame left, what passes is drawn. Then 
+    /// the pyramid is rebuilt from that depth and the second phase tests all the others against it,
+    /// drawing what the first phase missed: objects that came into view don't pop in a frame late.
+    /// A buffer indexed by object id keeps who was visible from one frame to the next.
+    /// The batcher's last Build must have been for gpu culling. Requires myvk::Device::gDevice.
+    /// </summary>
+    class CullingPipeline {
+    public:
+        /// <summary>
+        /// objectDescriptorSetLayout is the layout of the pages of the object pool, set 1 of the 
+        /// shader, and cameraDescriptorSetLayout the camera's, set 2. They must be visible to the
+        /// compute stage. The pyramid must outlive the pipeline.
+        /// </summary>
+        CullingPipeline(VkContext* ctx, VkDescriptorSetLayout objectDescriptorSetLayout,
+            VkDescriptorSetLayout cameraDescriptorSetLayout, const DepthPyramid* depthPyramid, 
+            const std::string& name);
+        ~CullingPipeline();
+        CullingPipeline(const CullingPipeline&) = delete;
+        CullingPipeline& operator=(const CullingPipeline&) = delete;
+        const std::string mName;
+        const VkContext* mCtx;
+        /// <summary>
+        /// Records a phase of the culling of the current frame's instances, one dispatch per page
+        /// of the pool, and the barrier that makes the results visible to the indirect draws and
+        /// the vertex input. Phase 0 goes first, phase 1 after the pyramid is built from what 
+        /// phase 0 drew. Must be recorded outside of a render pass.
+        /// Phase 0 also reports the culled and occluded counts of the last frame that used this
+        /// frame-in-flight slot to gFrameStats, they are MAX_FRAMES_IN_FLIGHT frames late.
+        /// </summary>
+        void Record(VkCommandBuffer cmd, const InstanceBatcher& batcher, const Frustum& frustum, uint32_t phase);
+    private:
+        /// <summary>
+        /// A buffer and its memory, mapped if host visible.
+        /// </summary>
+        struct CullingBuffer {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            void* address = nullptr;
+        };
+        void DestroyBuffer(CullingBuffer& buffer);
+        /// <summary>
+        /// Makes sure the visibility buffer has an entry per object id, recreating it cleared 
+        /// if it doesn't. Waits for the device to be idle then, it's shared by the frames in flight.
+        /// </summary>
+        void ReserveVisibility(VkCommandBuffer cmd, uint32_t numberOfIds);
+        /// <summary>
+        /// Points the frame's set at the batcher's buffers, they change when the batcher grows.
+        /// </summary>
+        void UpdateDescriptorSet(uint32_t frame, const InstanceBatcher& batcher);
+        const DepthPyramid* mDepthPyramid;
+        /// <summary>
+        /// Per object id: hidden, visible in the last frame or drawn by this frame's phase 0.
+        /// Only the gpu touches it.
+        /// </summary>
+        CullingBuffer mVisibility;
+        uint32_t mVisibilityCapacity = 0;
+        /// <summary>
+        /// Per frame, how many instances the frustum and the occlusion culled. Host visible.
+        /// </summary>
+        std::array<CullingBuffer, MAX_FRAMES_IN_FLIGHT> mCounters;
+        VkDescriptorSetLayout mDescriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+        std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> mDescriptorSets{};
+        VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline mPipeline = VK_NULL_HANDLE;
+    };
+}
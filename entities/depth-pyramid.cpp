@@ -0,0 +1,314 @@
+#include "depth-pyramid.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include "pipeline.h"
+#include "image.h"
+#include "vk/my-vk.h"
+#include "vk/my-device.h"
+#include "vk/my-instance.h"
+#include "utils/object_namer.h"
+#include "utils/concatenate.h"
+#include "utils/frame-stats.h"
+#include "utils/commandBufferUtils.h"
+
+namespace entities {
+    /// <summary>
+    /// Invocations per workgroup on each side, same as local_size_x and local_size_y in depth_pyramid.comp.
+    /// </summary>
+    static const uint32_t PYRAMID_WORKGROUP_SIZE = 8;
+    /// <summary>
+    /// Push constants of depth_pyramid.comp.
+    /// </summary>
+    struct PyramidConstants {
+        int32_t sourceWidth;
+        int32_t sourceHeight;
+        int32_t destinationWidth;
+        int32_t destinationHeight;
+    };
+
+    /// <summary>
+    /// Layout transitions of depth/stencil images must name both aspects.
+    /// </summary>
+    static VkImageAspectFlags DepthAspect()
+    {
+        const VkFormat format = DepthBufferManager::findDepthFormat(myvk::Instance::gInstance->GetPhysicalDevice());
+        const bool hasStencil = format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+        return VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+    }
+
+    DepthPyramid::DepthPyramid(VkImage depthImage, VkImageView depthImageView, uint32_t width, uint32_t height,
+        const std::string& name) :mName(name), mDepthImage(depthImage), mDepthAspect(DepthAspect()),
+        mDepthWidth(width), mDepthHeight(height)
+    {
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        //halve until 1x1, rounding up so that no pixel is left out
+        VkExtent2D size = { std::max(1u, (width + 1) / 2), std::max(1u, (height + 1) / 2) };
+        while (true) {
+            mLevelSizes.push_back(size);
+            if (size.width == 1 && size.height == 1)
+                break;
+            size = { std::max(1u, (size.width + 1) / 2), std::max(1u, (size.height + 1) / 2) };
+        }
+        mNumberOfLevels = static_cast<uint32_t>(mLevelSizes.size());
+        //the image
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent = { mLevelSizes[0].width, mLevelSizes[0].height, 1 };
+        imageInfo.mipLevels = mNumberOfLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = VK_FORMAT_R32_SFLOAT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateImage(device, &imageInfo, nullptr, &mImage) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create depth pyramid image!");
+        }
+        SET_NAME(mImage, VK_OBJECT_TYPE_IMAGE, Concatenate(name, "ImageObject").c_str());
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, mImage, &memRequirements);
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &mMemory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate depth pyramid memory!");
+        }
+        SET_NAME(mMemory, VK_OBJECT_TYPE_DEVICE_MEMORY, Concatenate(name, "DeviceMemory").c_str());
+        vkBindImageMemory(device, mImage, mMemory, 0);
+        //to VK_IMAGE_LAYOUT_GENERAL once and for all, the culling's sets say that's where it is
+        //even before the first Record
+        VkCommandPool commandPool = myvk::Device::gDevice->GetCommandPool();
+        VkCommandBuffer cmd = CreateCommandBuffer(commandPool, device, Concatenate(name, "LayoutCommand"));
+        BeginRecordingCommands(cmd);
+        VkImageMemoryBarrier layoutBarrier{};
+        layoutBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        layoutBarrier.srcAccessMask = 0;
+        layoutBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        layoutBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        layoutBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        layoutBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        layoutBarrier.image = mImage;
+        layoutBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mNumberOfLevels, 0, 1 };
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &layoutBarrier);
+        SubmitAndFinishCommands(cmd, myvk::Device::gDevice->GetGraphicsQueue(), device, commandPool);
+        //the views, the whole chain and one per level
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = mImage;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = VK_FORMAT_R32_SFLOAT;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = mNumberOfLevels;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(device, &viewInfo, nullptr, &mImageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create depth pyramid image view!");
+        }
+        SET_NAME(mImageView, VK_OBJECT_TYPE_IMAGE_VIEW, Concatenate(name, "ImageView").c_str());
+        mLevelViews.resize(mNumberOfLevels);
+        for (uint32_t level = 0; level < mNumberOfLevels; level++) {
+            viewInfo.subresourceRange.baseMipLevel = level;
+            viewInfo.subresourceRange.levelCount = 1;
+            if (vkCreateImageView(device, &viewInfo, nullptr, &mLevelViews[level]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create depth pyramid level view!");
+            }
+            SET_NAME(mLevelViews[level], VK_OBJECT_TYPE_IMAGE_VIEW, Concatenate(name, "Level", level, "ImageView").c_str());
+        }
+        //read with texelFetch, the filtering doesn't matter
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxLod = static_cast<float>(mNumberOfLevels);
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &mSampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create depth pyramid sampler!");
+        }
+        SET_NAME(mSampler, VK_OBJECT_TYPE_SAMPLER, Concatenate(name, "Sampler").c_str());
+        //the sets, binding 0 is the source and binding 1 the level being written
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &mDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout for depth pyramid");
+        }
+        SET_NAME(mDescriptorSetLayout, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, Concatenate(name, "DescriptorSetLayout").c_str());
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[0].descriptorCount = mNumberOfLevels;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        poolSizes[1].descriptorCount = mNumberOfLevels;
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = mNumberOfLevels;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create depth pyramid descriptor pool!");
+        }
+        SET_NAME(mDescriptorPool, VK_OBJECT_TYPE_DESCRIPTOR_POOL, Concatenate(name, "DescriptorPool").c_str());
+        std::vector<VkDescriptorSetLayout> layouts(mNumberOfLevels, mDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo setAllocInfo{};
+        setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocInfo.descriptorPool = mDescriptorPool;
+        setAllocInfo.descriptorSetCount = mNumberOfLevels;
+        setAllocInfo.pSetLayouts = layouts.data();
+        mDescriptorSets.resize(mNumberOfLevels);
+        if (vkAllocateDescriptorSets(device, &setAllocInfo, mDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets for depth pyramid!");
+        }
+        //the views never change, the sets are written once
+        for (uint32_t level = 0; level < mNumberOfLevels; level++) {
+            VkDescriptorImageInfo sourceInfo{};
+            sourceInfo.sampler = mSampler;
+            sourceInfo.imageView = level == 0 ? depthImageView : mLevelViews[level - 1];
+            sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+            VkDescriptorImageInfo destinationInfo{};
+            destinationInfo.imageView = mLevelViews[level];
+            destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            std::array<VkWriteDescriptorSet, 2> writes{};
+            writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[0].dstSet = mDescriptorSets[level];
+            writes[0].dstBinding = 0;
+            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[0].descriptorCount = 1;
+            writes[0].pImageInfo = &sourceInfo;
+            writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[1].dstSet = mDescriptorSets[level];
+            writes[1].dstBinding = 1;
+            writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[1].descriptorCount = 1;
+            writes[1].pImageInfo = &destinationInfo;
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+        //the pipeline
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(PyramidConstants);
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+        SET_NAME(mPipelineLayout, VK_OBJECT_TYPE_PIPELINE_LAYOUT, Concatenate(name, "PipelineLayout").c_str());
+        VkShaderModule computeShaderModule = Pipeline::LoadShaderModule(device, "depth_pyramid_comp.spv");
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = computeShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = mPipelineLayout;
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline!");
+        }
+        SET_NAME(mPipeline, VK_OBJECT_TYPE_PIPELINE, name.c_str());
+        vkDestroyShaderModule(device, computeShaderModule, nullptr);
+    }
+
+    DepthPyramid::~DepthPyramid()
+    {
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        vkDestroyPipeline(device, mPipeline, nullptr);
+        vkDestroyPipelineLayout(device, mPipelineLayout, nullptr);
+        //destroying the pool frees its sets
+        vkDestroyDescriptorPool(device, mDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, mDescriptorSetLayout, nullptr);
+        vkDestroySampler(device, mSampler, nullptr);
+        for (VkImageView view : mLevelViews)
+            vkDestroyImageView(device, view, nullptr);
+        vkDestroyImageView(device, mImageView, nullptr);
+        vkDestroyImage(device, mImage, nullptr);
+        vkFreeMemory(device, mMemory, nullptr);
+    }
+
+    void DepthPyramid::Record(VkCommandBuffer cmd)
+    {
+        //the depth buffer goes from being drawn to being read, and the pyramid from being read by
+        //the last culling to being written
+        std::array<VkImageMemoryBarrier, 2> barriers{};
+        barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[0].image = mDepthImage;
+        barriers[0].subresourceRange = { mDepthAspect, 0, 1, 0, 1 };
+        barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[1].image = mImage;
+        barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mNumberOfLevels, 0, 1 };
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+        gFrameStats.pipelineBinds.fetch_add(1, std::memory_order_relaxed);
+        //each level reads the one before, they go one after the other
+        VkMemoryBarrier levelBarrier{};
+        levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        for (uint32_t level = 0; level < mNumberOfLevels; level++) {
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout,
+                0, 1, &mDescriptorSets[level], 0, nullptr);
+            gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+            const VkExtent2D source = level == 0 ? VkExtent2D{ mDepthWidth, mDepthHeight } : mLevelSizes[level - 1];
+            const VkExtent2D destination = mLevelSizes[level];
+            PyramidConstants constants{
+                static_cast<int32_t>(source.width), static_cast<int32_t>(source.height),
+                static_cast<int32_t>(destination.width), static_cast<int32_t>(destination.height) };
+            vkCmdPushConstants(cmd, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PyramidConstants), &constants);
+            vkCmdDispatch(cmd,
+                (destination.width + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE,
+                (destination.height + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE, 1);
+            //the last one is for the culling that comes next
+            vkCmdPipelineBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+        }
+        //the depth buffer goes back to being drawn on
+        VkImageMemoryBarrier depthBarrier = barriers[0];
+        depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        depthBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+namespace entities {
+    /// <summary>
+    /// Hierarchical depth (Hi-Z) of a depth buffer, for the occlusion culling: an R32 float image
+    /// with a full mip chain where each texel holds the farthest depth of the 2x2 texels under it.
+    /// Level 0 is half the depth buffer, rounded up, so a texel of level L covers 2^(L+1) pixels 
+    /// of the depth buffer on each side. Built by a compute shader, depth_pyramid.comp, one 
+    /// dispatch per level. The image is moved to VK_IMAGE_LAYOUT_GENERAL when it's created and
+    /// stays there, its contents are undefined until the first Record.
+    /// Requires myvk::Device::gDevice and myvk::Instance::gInstance.
+    /// </summary>
+    class DepthPyramid {
+    public:
+        /// <summary>
+        /// depthImage is a depth buffer of DepthBufferManager, sampleable, and depthImageView its view.
+        /// </summary>
+        DepthPyramid(VkImage depthImage, VkImageView depthImageView, uint32_t width, uint32_t height,
+            const std::string& name);
+        ~DepthPyramid();
+        DepthPyramid(const DepthPyramid&) = delete;
+        DepthPyramid& operator=(const DepthPyramid&) = delete;
+        const std::string mName;
+        /// <summary>
+        /// Records the build of the pyramid from what the depth buffer holds. The depth buffer 
+        /// must be in VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, with the draws done, and
+        /// is left that way. Must be recorded outside of a render pass. The pyramid is ready for
+        /// the compute shaders that come after.
+        /// </summary>
+        void Record(VkCommandBuffer cmd);
+        /// <summary>
+        /// The whole mip chain, with a sampler to read it with texelFetch.
+        /// </summary>
+        VkImageView GetImageView()const { return mImageView; }
+        VkSampler GetSampler()const { return mSampler; }
+        uint32_t GetNumberOfLevels()const { return mNumberOfLevels; }
+        /// <summary>
+        /// Size of the depth buffer the pyramid is built from.
+        /// </summary>
+        uint32_t GetDepthWidth()const { return mDepthWidth; }
+        uint32_t GetDepthHeight()const { return mDepthHeight; }
+    private:
+        const VkImage mDepthImage;
+        const VkImageAspectFlags mDepthAspect;
+        const uint32_t mDepthWidth;
+        const uint32_t mDepthHeight;
+        uint32_t mNumberOfLevels = 0;
+        /// <summary>
+        /// Size of each level.
+        /// </summary>
+        std::vector<VkExtent2D> mLevelSizes;
+        VkImage mImage = VK_NULL_HANDLE;
+        VkDeviceMemory mMemory = VK_NULL_HANDLE;
+        VkImageView mImageView = VK_NULL_HANDLE;
+        /// <summary>
+        /// One view per level. The dispatch of a level writes its view and reads the one before.
+        /// </summary>
+        std::vector<VkImageView> mLevelViews;
+        VkSampler mSampler = VK_NULL_HANDLE;
+        VkDescriptorSetLayout mDescriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+        /// <summary>
+        /// One set per level: its source (the depth buffer for level 0) and its view.
+        /// </summary>
+        std::vector<VkDescriptorSet> mDescriptorSets;
+        VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline mPipeline = VK_NULL_HANDLE;
+    };
+}
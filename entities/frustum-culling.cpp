@@ -0,0 +1,86 @@
+#include "frustum-culling.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace entities {
+    Frustum ExtractFrustum(const glm::mat4& m)
+    {
+        //the rows of the matrix, glm is column major
+        const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0; //left
+        frustum.planes[1] = row3 - row0; //right
+        frustum.planes[2] = row3 + row1; //bottom
+        frustum.planes[3] = row3 - row1; //top
+        frustum.planes[4] = row2;        //near, z goes from 0 not from -w
+        frustum.planes[5] = row3 - row2; //far
+        for (auto& plane : frustum.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+        return frustum;
+    }
+
+    uint32_t CullSpheresScalar(const Frustum& frustum, const BoundsArrays& bounds, uint32_t first, uint32_t count,
+        uint8_t* visible)
+    {
+        uint32_t numberOfVisible = 0;
+        for (uint32_t id = first; id < first + count; id++) {
+            const glm::vec3 center(bounds.x[id], bounds.y[id], bounds.z[id]);
+            bool inside = true;
+            for (const auto& plane : frustum.planes) {
+                if (glm::dot(glm::vec3(plane), center) + plane.w < -bounds.radius[id]) {
+                    inside = false;
+                    break;
+                }
+            }
+            visible[id] = inside ? 1 : 0;
+            numberOfVisible += inside ? 1 : 0;
+        }
+        return numberOfVisible;
+    }
+
+    uint32_t CullSpheresSimd(const Frustum& frustum, const BoundsArrays& bounds, uint32_t first, uint32_t count,
+        uint8_t* visible)
+    {
+#ifdef FRUSTUM_CULLING_SSE
+        //each plane component in all 4 lanes
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (uint32_t p = 0; p < 6; p++) {
+            planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        uint32_t numberOfVisible = 0;
+        const uint32_t end = first + count;
+        for (uint32_t block = first; block < end; block += 4) {
+            const __m128 x = _mm_loadu_ps(bounds.x + block);
+            const __m128 y = _mm_loadu_ps(bounds.y + block);
+            const __m128 z = _mm_loadu_ps(bounds.z + block);
+            const __m128 minusRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(bounds.radius + block));
+            //lanes whose sphere is outside of some plane
+            __m128 outside = _mm_setzero_ps();
+            for (uint32_t p = 0; p < 6; p++) {
+                const __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                    _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, minusRadius));
+            }
+            const int outsideMask = _mm_movemask_ps(outside);
+            for (uint32_t lane = 0; lane < 4 && block + lane < end; lane++) {
+                const uint8_t inside = (outsideMask & (1 << lane)) == 0 ? 1 : 0;
+                visible[block + lane] = inside;
+                numberOfVisible += inside;
+            }
+        }
+        return numberOfVisible;
+#else
+        return CullSpheresScalar(frustum, bounds, first, count, visible);
+#endif
+    }
+}
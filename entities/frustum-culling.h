@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "transform-store.h"
+namespace entities {
+    /// <summary>
+    /// The 6 planes of a view frustum as (normal, distance), normals pointing inside and of 
+    /// length 1, so dot(normal, p) + distance is the signed distance of p to the plane.
+    /// </summary>
+    struct Frustum {
+        std::array<glm::vec4, 6> planes;
+    };
+    /// <summary>
+    /// The frustum of a projection * view matrix with depth in [0, 1], like GLM_FORCE_DEPTH_ZERO_TO_ONE
+    /// makes. Flipping y in the projection swaps the top and bottom planes, it doesn't matter.
+    /// </summary>
+    Frustum ExtractFrustum(const glm::mat4& viewProjection);
+    /// <summary>
+    /// For the spheres [first, first + count), sets visible[id] to 1 if the sphere touches the 
+    /// frustum and 0 if it's completely outside one of the planes. Returns how many are visible.
+    /// This one does one sphere at a time, it's the reference for the SIMD version.
+    /// </summary>
+    uint32_t CullSpheresScalar(const Frustum& frustum, const BoundsArrays& bounds, uint32_t first, uint32_t count,
+        uint8_t* visible);
+    /// <summary>
+    /// Same as CullSpheresScalar but 4 spheres at a time with SSE. The arrays must be readable up
+    /// to first + count rounded up to 4. Falls back to the scalar version when SSE isn't available.
+    /// </summary>
+    uint32_t CullSpheresSimd(const Frustum& frustum, const BoundsArrays& bounds, uint32_t first, uint32_t count,
+        uint8_t* visible);
+}
@@ -8,75 +8,52 @@
 #include "vk/my-vk.h"
 #include "vk/my-device.h"
 #include "vk/my-instance.h"
-#include <map>
+#include <mutex>
+#include <algorithm>
+#include "utils/id-allocator.h"
 /// <summary>
 /// The global pool for object buffer uniforms
 /// </summary>
 static entities::GameObjectUniformBufferPool* gUniformBufferPool = nullptr;
 /// <summary>
-/// List of available id for game objects. Its important because there's a limited number of possible
-/// game objects, limited by the number of descriptor sets in the pool and memory allocated on the 
-/// uniform buffer. The game object id is directly related to the offset in the memory and the specific
-/// descriptor set bound to that offset. 
+/// Ids of the game objects. The game object id is directly related to the page in the uniform 
+/// buffer pool, the offset in the page's memory and the specific descriptor set bound to that 
+/// offset, so ids are kept dense: freed ids are reused before new ones are created.
 /// </summary>
-static std::map<uint32_t, bool> gAvailableGameObjectsIds;
-/// <summary>
-/// Returns an id in [0, MAX_NUMBER_OF_GAME_OBJECTS). If all IDs are used it blows up with runtime error
-/// </summary>
-/// <returns></returns>
-uint32_t GetNextGameObjectId() {
-    //initialize the list
-    if (gAvailableGameObjectsIds.size() == 0) {
-        for (uint32_t i = 0; i < MAX_NUMBER_OF_GAME_OBJECTS; i++) {
-            gAvailableGameObjectsIds.insert({ i, true });
-        }
-    }
-    int key = UINT32_MAX;
-    for (const auto& [k, v] : gAvailableGameObjectsIds) {
-        if (v == true) {
-            key = k;
-            break;
-        }
-    }
-    if (key == UINT32_MAX) {
-        throw std::runtime_error("all possible game objects are alredy allocated");
-    }
-    return key;
-}
+static utils::IdAllocator gGameObjectIds;
 
 namespace entities {
+    bool GameObject::IsAlive(utils::IdHandle handle)
+    {
+        return gGameObjectIds.IsAlive(handle);
+    }
     GameObject::GameObject(VkContext* ctx, const std::string& name):
         mName(name), mDevice(myvk::Device::gDevice->GetDevice()),
-        mOrientation(glm::quat()), mPosition(glm::vec3(0,0,0)),
-        mId(GetNextGameObjectId())
+        mHandle(gGameObjectIds.Allocate()), mId(mHandle.index)
     {
-        assert(gAvailableGameObjectsIds.size() == MAX_NUMBER_OF_GAME_OBJECTS);
-        for (auto i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            auto objects = GameObjectUniformBufferPool::Get(mId*MAX_FRAMES_IN_FLIGHT + i); //the vk objects are contiguous.
-            uintptr_t offset = objects.first;
-            VkDescriptorSet descriptorSet = objects.second;
-            helloObjectUniformBufferAddress[i] = offset;
-            helloObjectDescriptorSets[i] = descriptorSet;
+        try {
+            for (auto i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                auto objects = GameObjectUniformBufferPool::Get(mId, i);
+                uintptr_t address = objects.first;
+                VkDescriptorSet descriptorSet = objects.second;
+                helloObjectUniformBufferAddress[i] = address;
+                mObjectDescriptorSet = descriptorSet;
+            }
         }
-        //i'm using this game object slot
-        gAvailableGameObjectsIds[mId] = false;
+        catch (...) {
+            //the pool couldn't grow, the destructor won't run so the id must be given back here
+            gGameObjectIds.Free(mHandle);
+            throw;
+        }
+        //identity transform, dirty for every frame
+        TransformStore::Instance().Add(mId, helloObjectUniformBufferAddress);
     }
     GameObject::~GameObject()
     {
         //give the slot back
-        gAvailableGameObjectsIds[mId] = true;
-    }
-    void GameObject::CommitDataToObjectBuffer(uint32_t currentFrame)
-    {
-        ObjectUniformBuffer objBuffer;
-        objBuffer.model = glm::mat4(1.0f);
-        objBuffer.model *= glm::translate(glm::mat4(1.0f), mPosition);
-        objBuffer.model *= glm::mat4_cast(mOrientation);
-        void* addr = reinterpret_cast<void*>(GameObjectUniformBufferPool::BaseAddress() + 
-            helloObjectUniformBufferAddress[currentFrame]);
-        memcpy(addr, &objBuffer, sizeof(objBuffer));
+        TransformStore::Instance().Remove(mId);
+        gGameObjectIds.Free(mHandle);
     }
-
     uint32_t GameObjectUniformBufferPool::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkContext ctx)
     {
         VkPhysicalDeviceMemoryProperties memProperties;
@@ -92,105 +69,146 @@ namespace entities {
     GameObjectUniformBufferPool::GameObjectUniformBufferPool(VkContext* ctx)
         :mCtx(ctx)
     {
-        const int number_of_buffers = MAX_NUMBER_OF_GAME_OBJECTS * MAX_FRAMES_IN_FLIGHT;
+        //the records are an array, only the frame regions are dynamic offsets and those must be
+        //multiples of minStorageBufferOffsetAlignment
+        mStride = static_cast<uint32_t>(sizeof(ObjectUniformBuffer));
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(myvk::Instance::gInstance->GetPhysicalDevice(), &properties);
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minStorageBufferOffsetAlignment, 1);
+        if ((static_cast<VkDeviceSize>(mStride) * GAME_OBJECTS_PER_PAGE) % alignment != 0) {
+            throw std::runtime_error("object record frame regions don't meet minStorageBufferOffsetAlignment");
+        }
+        //the first page is created upfront, the others when the objects need them
+        mPages.push_back(CreatePage());
+    }
+
+    GameObjectUniformBufferPool::Page* GameObjectUniformBufferPool::CreatePage()
+    {
+        const int number_of_buffers = GAME_OBJECTS_PER_PAGE * MAX_FRAMES_IN_FLIGHT;
+        const uint32_t pageIndex = static_cast<uint32_t>(mPages.size());
+        Page* page = new Page();
         //Create the descriptor pool
-        //object descriptor pool - there can be up to 100 objects 
+        //object descriptor pool - a single dynamic storage buffer descriptor for the whole page
         VkDescriptorPoolSize objectPoolSize{};
-        objectPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        objectPoolSize.descriptorCount = number_of_buffers; // Example: support up to 100 objects
+        objectPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        objectPoolSize.descriptorCount = 1;
         VkDescriptorPoolCreateInfo objectPoolInfo{};
         objectPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         objectPoolInfo.poolSizeCount = 1;
         objectPoolInfo.pPoolSizes = &objectPoolSize;
-        objectPoolInfo.maxSets = number_of_buffers; // Support up to 100 descriptor sets for objects
-        if (vkCreateDescriptorPool(myvk::Device::gDevice->GetDevice(), &objectPoolInfo, nullptr, &mObjectDescriptorPool) != VK_SUCCESS) {
+        objectPoolInfo.maxSets = 1;
+        if (vkCreateDescriptorPool(myvk::Device::gDevice->GetDevice(), &objectPoolInfo, nullptr, &page->mObjectDescriptorPool) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create object descriptor pool!");
         }
-        SET_NAME(mObjectDescriptorPool, VK_OBJECT_TYPE_DESCRIPTOR_POOL, "objectDescriptorPool");
+        SET_NAME(page->mObjectDescriptorPool, VK_OBJECT_TYPE_DESCRIPTOR_POOL, Concatenate("objectDescriptorPool", pageIndex).c_str());
         /////allocate the memory
         /////1) create the big buffer
         VkBufferCreateInfo bigAssBufferInfo{};
         bigAssBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bigAssBufferInfo.size = sizeof(ObjectUniformBuffer) * number_of_buffers;
-        bigAssBufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        bigAssBufferInfo.size = static_cast<VkDeviceSize>(mStride) * number_of_buffers;
+        bigAssBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
         bigAssBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        mBigBufferForDeviceMemoryAllocation = VK_NULL_HANDLE;
-        vkCreateBuffer(myvk::Device::gDevice->GetDevice(), &bigAssBufferInfo, nullptr, &mBigBufferForDeviceMemoryAllocation);
-        SET_NAME(mBigBufferForDeviceMemoryAllocation, VK_OBJECT_TYPE_BUFFER, "BigAssBufferForObjectUniform");
+        if (vkCreateBuffer(myvk::Device::gDevice->GetDevice(), &bigAssBufferInfo, nullptr, &page->mBigBufferForDeviceMemoryAllocation) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create object uniform buffer!");
+        }
+        SET_NAME(page->mBigBufferForDeviceMemoryAllocation, VK_OBJECT_TYPE_BUFFER, Concatenate("BigAssBufferForObjectUniform", pageIndex).c_str());
         VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(myvk::Device::gDevice->GetDevice(), mBigBufferForDeviceMemoryAllocation, &memRequirements);
+        vkGetBufferMemoryRequirements(myvk::Device::gDevice->GetDevice(), page->mBigBufferForDeviceMemoryAllocation, &memRequirements);
         VkMemoryAllocateInfo memoryAllocInfo{};
         memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
         memoryAllocInfo.allocationSize = memRequirements.size;
         memoryAllocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, *ctx);
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, *mCtx);
         //Allocate the memory for the big buffer
-        vkAllocateMemory(myvk::Device::gDevice->GetDevice(), &memoryAllocInfo, nullptr, &mBuffersMemory);
-        vkBindBufferMemory(myvk::Device::gDevice->GetDevice(), mBigBufferForDeviceMemoryAllocation, mBuffersMemory, 0);
-        //now that i have the buffer and the memory we can create the descriptor sets and update them.
-        //one descriptor set for each buffer. 
-        assert(ctx->helloObjectDescriptorSetLayout != VK_NULL_HANDLE);
-        std::vector<VkDescriptorSetLayout> layouts(number_of_buffers, ctx->helloObjectDescriptorSetLayout);
+        if (vkAllocateMemory(myvk::Device::gDevice->GetDevice(), &memoryAllocInfo, nullptr, &page->mBuffersMemory) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate object uniform buffer memory!");
+        }
+        vkBindBufferMemory(myvk::Device::gDevice->GetDevice(), page->mBigBufferForDeviceMemoryAllocation, page->mBuffersMemory, 0);
+        //now that i have the buffer and the memory we can create the descriptor set and update it.
+        //one descriptor set for the whole buffer, it sees one frame's region and the dynamic offset picks the frame
+        assert(mCtx->helloObjectDescriptorSetLayout != VK_NULL_HANDLE);
         VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
         descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        descriptorSetAllocInfo.descriptorPool = mObjectDescriptorPool;
-        //one descriptor set for each frame in flight
-        descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * MAX_NUMBER_OF_GAME_OBJECTS);
-        descriptorSetAllocInfo.pSetLayouts = layouts.data();
-        vkAllocateDescriptorSets(myvk::Device::gDevice->GetDevice(), &descriptorSetAllocInfo, mDescriptorSets.data());
-        //update each descriptor set. Mind the offset
-        for (size_t i = 0; i < number_of_buffers; i++) {
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = mBigBufferForDeviceMemoryAllocation;
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(ObjectUniformBuffer);
-            VkWriteDescriptorSet descriptorWrite{};
-            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrite.dstSet = mDescriptorSets[i];
-            descriptorWrite.dstBinding = 0;
-            descriptorWrite.dstArrayElement = 0;
-            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-            descriptorWrite.descriptorCount = 1;
-            descriptorWrite.pBufferInfo = &bufferInfo;
-            vkUpdateDescriptorSets(myvk::Device::gDevice->GetDevice(), 1, &descriptorWrite, 0, nullptr);
-            mUniformBufferOffsets[i] = sizeof(ObjectUniformBuffer) * i;
+        descriptorSetAllocInfo.descriptorPool = page->mObjectDescriptorPool;
+        descriptorSetAllocInfo.descriptorSetCount = 1;
+        descriptorSetAllocInfo.pSetLayouts = &mCtx->helloObjectDescriptorSetLayout;
+        if (vkAllocateDescriptorSets(myvk::Device::gDevice->GetDevice(), &descriptorSetAllocInfo, &page->mDescriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate object descriptor set!");
         }
-        //map the memory
-        vkMapMemory(myvk::Device::gDevice->GetDevice(), mBuffersMemory, 0,
-            sizeof(ObjectUniformBuffer) * number_of_buffers, 0, &mBaseAddress);
-        //now we are done - we have the descriptor sets, mapped to positions in the buffer, and memories for these positions.
+        SET_NAME(page->mDescriptorSet, VK_OBJECT_TYPE_DESCRIPTOR_SET, Concatenate("objectDescriptorSet", pageIndex).c_str());
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = page->mBigBufferForDeviceMemoryAllocation;
+        bufferInfo.offset = 0;
+        bufferInfo.range = static_cast<VkDeviceSize>(mStride) * GAME_OBJECTS_PER_PAGE;
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = page->mDescriptorSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(myvk::Device::gDevice->GetDevice(), 1, &descriptorWrite, 0, nullptr);
+        //map the memory, it stays mapped for the page's whole life
+        vkMapMemory(myvk::Device::gDevice->GetDevice(), page->mBuffersMemory, 0,
+            static_cast<VkDeviceSize>(mStride) * number_of_buffers, 0, &page->mBaseAddress);
+        //now we are done - we have the descriptor set, the buffer and its mapped memory.
+        return page;
+    }
+
+    void GameObjectUniformBufferPool::DestroyPage(Page* page)
+    {
+        vkUnmapMemory(myvk::Device::gDevice->GetDevice(), page->mBuffersMemory);
+        vkFreeMemory(myvk::Device::gDevice->GetDevice(), page->mBuffersMemory, nullptr);
+        vkDestroyBuffer(myvk::Device::gDevice->GetDevice(), page->mBigBufferForDeviceMemoryAllocation, nullptr);
+        vkDestroyDescriptorPool(myvk::Device::gDevice->GetDevice(), page->mObjectDescriptorPool, nullptr);
+        delete page;
     }
 
     GameObjectUniformBufferPool::~GameObjectUniformBufferPool()
     {
-        vkUnmapMemory(myvk::Device::gDevice->GetDevice(), mBuffersMemory);
-        vkFreeMemory(myvk::Device::gDevice->GetDevice(), mBuffersMemory, nullptr);
-        vkDestroyBuffer(myvk::Device::gDevice->GetDevice(), mBigBufferForDeviceMemoryAllocation, nullptr);
-        vkDestroyDescriptorPool(myvk::Device::gDevice->GetDevice(), mObjectDescriptorPool, nullptr);
+        for (auto page : mPages) {
+            DestroyPage(page);
+        }
+        mPages.clear();
     }
 
-    std::pair<uintptr_t, VkDescriptorSet> GameObjectUniformBufferPool::Get(uint32_t i)
+    std::pair<uintptr_t, VkDescriptorSet> GameObjectUniformBufferPool::Get(uint32_t id, uint32_t frame)
     {
         assert(gUniformBufferPool != nullptr);
-        return std::pair<uintptr_t, VkDescriptorSet>(gUniformBufferPool->mUniformBufferOffsets[i],
-            gUniformBufferPool->mDescriptorSets[i]);
+        //objects may be created from loader threads and a new page changes mPages
+        std::lock_guard<std::mutex> lock(gUniformBufferPool->mPagesMutex);
+        const uint32_t pageIndex = id / GAME_OBJECTS_PER_PAGE;
+        //pages are never moved or destroyed while the pool lives so growing doesn't disturb the frames in flight
+        while (gUniformBufferPool->mPages.size() <= pageIndex) {
+            gUniformBufferPool->mPages.push_back(gUniformBufferPool->CreatePage());
+        }
+        Page* page = gUniformBufferPool->mPages[pageIndex];
+        const uint32_t slot = frame * GAME_OBJECTS_PER_PAGE + (id % GAME_OBJECTS_PER_PAGE); //one region per frame, objects contiguous in it
+        uintptr_t address = reinterpret_cast<uintptr_t>(page->mBaseAddress) + static_cast<uintptr_t>(gUniformBufferPool->mStride) * slot;
+        return std::pair<uintptr_t, VkDescriptorSet>(address, page->mDescriptorSet);
     }
 
+    uint32_t GameObjectUniformBufferPool::Stride()
+    {
+        assert(gUniformBufferPool != nullptr);
+        return gUniformBufferPool->mStride;
+    }
 
+    uint32_t GameObjectUniformBufferPool::FrameOffset(uint32_t frame)
+    {
+        return frame * GAME_OBJECTS_PER_PAGE * Stride();
+    }
 
     void GameObjectUniformBufferPool::Initialize(VkContext* ctx)
     {
         assert(gUniformBufferPool == nullptr);
         gUniformBufferPool = new GameObjectUniformBufferPool(ctx);
     }
-    uintptr_t GameObjectUniformBufferPool::BaseAddress()
-    {
-        assert(gUniformBufferPool != nullptr);
-        return reinterpret_cast<uintptr_t>(gUniformBufferPool->mBaseAddress);
-    }
     void GameObjectUniformBufferPool::Destroy()
     {
         assert(gUniformBufferPool != nullptr);
         delete gUniformBufferPool;
+        gUniformBufferPool = nullptr;
     }
 }
@@ -5,87 +5,156 @@
 #include <vector>
 #include <glm/gtc/quaternion.hpp>
 #include <array>
-#define MAX_NUMBER_OF_GAME_OBJECTS 100
+#include <mutex>
+#include "utils/id-allocator.h"
+#include "transform-store.h"
+/// <summary>
+/// How many game objects fit in a page of the uniform buffer pool. The pool grows one page at
+/// a time, so this is not a limit on the number of objects.
+/// </summary>
+#define GAME_OBJECTS_PER_PAGE 1024
 struct VkContext;
 namespace entities {
     class Mesh;
     /// <summary>
-    /// Holds object-specific data. Corresponds to ObjectUniformBuffer in 
-    /// hello_shader.vert
+    /// Holds object-specific data. Corresponds to ObjectRecord in hello_shader.vert and 
+    /// gpu_picker.vert, an element of a std430 array, so the records are sizeof apart.
     /// </summary>
     struct alignas(16) ObjectUniformBuffer {
         /// <summary>
         /// Model matrix
         /// </summary>
         alignas(16)glm::mat4 model;
+        /// <summary>
+        /// The game object id, the same the gpu picker encodes as color
+        /// </summary>
+        uint32_t objectId;
     };
     
     /// <summary>
-    /// This class holds the pool of uniform buffers for game objects. The size of each entry in the pool is MAX_NUMBER_OF_GAME_OBJECTS
-    /// and gObjectDescriptorPool must take that size into account too. Also take into account that because we have multiple frames in
-    /// flight (MAX_FRAMES_IN_FLIGHT) there must be a buffer for each frame in flight to not mix data from one frame into other
+    /// This class holds the pool of object records for game objects. The pool is made of pages, each one 
+    /// with its own buffer, memory and descriptor pool, sized for GAME_OBJECTS_PER_PAGE objects. Also take 
+    /// into account that because we have multiple frames in flight (MAX_FRAMES_IN_FLIGHT) there must be a 
+    /// record for each frame in flight to not mix data from one frame into other.
+    /// Pages are created on demand and never move, so a game object's slot is stable for its whole life.
+    /// The shaders read a page as a storage buffer array indexed by id % GAME_OBJECTS_PER_PAGE, so 
+    /// instanced draws can reach every object of the page with a single bind.
     /// </summary>
     class GameObjectUniformBufferPool {
     public:
         static uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkContext ctx);
         GameObjectUniformBufferPool(VkContext* ctx);
         ~GameObjectUniformBufferPool();
-
-        static std::pair<uintptr_t, VkDescriptorSet> Get(uint32_t i);
+        /// <summary>
+        /// Returns the mapped address of the game object id for a frame in flight and the descriptor set
+        /// of its page. Creates the page the id belongs to if it doesn't exist yet.
+        /// </summary>
+        static std::pair<uintptr_t, VkDescriptorSet> Get(uint32_t id, uint32_t frame);
+        /// <summary>
+        /// Distance between two records in a page, the std430 array stride of ObjectRecord.
+        /// </summary>
+        static uint32_t Stride();
+        /// <summary>
+        /// Dynamic offset of a frame's region in a page's buffer.
+        /// </summary>
+        static uint32_t FrameOffset(uint32_t frame);
         /// <summary>
         /// Call this before creating any uniform buffer. It initializes the pool
         /// </summary>
         /// <param name="ctx"></param>
         static void Initialize(VkContext* ctx);
-
-        static uintptr_t BaseAddress();
         /// <summary>
         /// Destroy the pool. Since it depends upon a valid VkDevice do that before destroying the device
         /// </summary>
         static void Destroy();
     private:
+        /// <summary>
+        /// GAME_OBJECTS_PER_PAGE * MAX_FRAMES_IN_FLIGHT records in one VkBuffer. The buffer is 
+        /// split in one region per frame in flight, with the objects contiguous inside it, so the per-frame 
+        /// transform update writes a frame's records sequentially. There's a single STORAGE_BUFFER_DYNAMIC 
+        /// descriptor set for the whole page that covers one region, the dynamic offset selects the frame.
+        /// </summary>
+        struct Page {
+            void* mBaseAddress = nullptr;
+            VkDescriptorPool mObjectDescriptorPool = VK_NULL_HANDLE;
+            VkBuffer mBigBufferForDeviceMemoryAllocation = VK_NULL_HANDLE;
+            VkDeviceMemory mBuffersMemory = VK_NULL_HANDLE;
+            VkDescriptorSet mDescriptorSet = VK_NULL_HANDLE;
+        };
+        Page* CreatePage();
+        void DestroyPage(Page* page);
         const VkContext* mCtx;
-        void* mBaseAddress;
-        VkDescriptorPool mObjectDescriptorPool = VK_NULL_HANDLE;
-        VkBuffer mBigBufferForDeviceMemoryAllocation = VK_NULL_HANDLE;
-        VkDeviceMemory mBuffersMemory = VK_NULL_HANDLE;
-
-        std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT* MAX_NUMBER_OF_GAME_OBJECTS> mUniformBufferOffsets;
-        std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT* MAX_NUMBER_OF_GAME_OBJECTS> mDescriptorSets;
+        uint32_t mStride;
+        std::vector<Page*> mPages;
+        std::mutex mPagesMutex;
     };
     /// <summary>
-    /// Base class for objects that exist in the world. The model matrix and 
-    /// its descriptor set belongs to this class.
+    /// Base class for objects that exist in the world. The object's record in the uniform pool
+    /// and its descriptor set belong to this class, the transform is kept in the TransformStore.
     /// </summary>
     class GameObject {
     public:
         GameObject(VkContext* ctx, 
             const std::string& name);
-        void SetPosition(glm::vec3& pos) {
-            mPosition = pos;
+        //The transform lives in the TransformStore, indexed by the id
+        void SetPosition(const glm::vec3& pos) {
+            TransformStore::Instance().SetPosition(mId, pos);
         }
-        glm::vec3 GetPosition()const { return mPosition; }
-        void SetOrientation(glm::quat& o) {
-            mOrientation = o;
+        glm::vec3 GetPosition()const { return TransformStore::Instance().GetPosition(mId); }
+        void SetOrientation(const glm::quat& o) {
+            TransformStore::Instance().SetOrientation(mId, o);
         }
-        glm::quat GetOrientation()const { return mOrientation; }
-        ~GameObject();
-        uint32_t DynamicOffset(uint32_t frame)const {
-            return (mId * MAX_FRAMES_IN_FLIGHT + frame) * sizeof(ObjectUniformBuffer);
+        glm::quat GetOrientation()const { return TransformStore::Instance().GetOrientation(mId); }
+        void SetScale(const glm::vec3& scale) {
+            TransformStore::Instance().SetScale(mId, scale);
         }
+        glm::vec3 GetScale()const { return TransformStore::Instance().GetScale(mId); }
+        /// <summary>
+        /// Attaches the object to parent, nullptr detaches it. Position, orientation and scale 
+        /// become relative to the parent.
+        /// </summary>
+        void SetParent(const GameObject* parent) {
+            TransformStore::Instance().SetParent(mId, parent != nullptr ? parent->mId : NO_PARENT);
+        }
+        /// <summary>
+        /// Id of the parent or NO_PARENT.
+        /// </summary>
+        uint32_t GetParentId()const { return TransformStore::Instance().GetParent(mId); }
+        /// <summary>
+        /// Model matrix including the parents.
+        /// </summary>
+        glm::mat4 GetWorldMatrix()const { return TransformStore::Instance().GetWorldMatrix(mId); }
+        ~GameObject();
+        /// <summary>
+        /// False if the game object the handle came from was destroyed.
+        /// </summary>
+        static bool IsAlive(utils::IdHandle handle);
 
+        /// <summary>
+        /// Id and generation. Keep the handle instead of the pointer to find out if the object 
+        /// was destroyed, see IsAlive.
+        /// </summary>
+        const utils::IdHandle mHandle;
         const uint32_t mId;
         
         const std::string mName;
         const VkDevice mDevice;
-        void CommitDataToObjectBuffer(uint32_t currentFrame);
-        VkDescriptorSet GetDescriptorSet(uint32_t id) const {
-            return helloObjectDescriptorSets[id];
+        /// <summary>
+        /// True if the transform changed since the frame's record was last written. Each frame in
+        /// flight has its own copy of the record, so a change must be written MAX_FRAMES_IN_FLIGHT times.
+        /// </summary>
+        bool IsDirty(uint32_t frame)const {
+            return TransformStore::Instance().IsDirty(mId, frame);
+        }
+        /// <summary>
+        /// The descriptor set of the object's page, to be bound with GameObjectUniformBufferPool::FrameOffset.
+        /// Objects in the same page share it.
+        /// </summary>
+        VkDescriptorSet GetDescriptorSet() const {
+            return mObjectDescriptorSet;
         }
     private:
-        glm::vec3 mPosition;
-        glm::quat mOrientation;
         std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT> helloObjectUniformBufferAddress;
-        std::array<VkDescriptorSet,MAX_FRAMES_IN_FLIGHT> helloObjectDescriptorSets;
+        VkDescriptorSet mObjectDescriptorSet = VK_NULL_HANDLE;
     };
 }
\ No newline at end of file
@@ -376,7 +376,8 @@ namespace entities {
         return findSupportedFormat(
             { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
             VK_IMAGE_TILING_OPTIMAL,
-            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT,
+            //sampled by the depth pyramid
+            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT,
             physicalDevice
         );
     }
@@ -412,7 +413,7 @@ namespace entities {
         for (int i = 0; i < images.size(); i++) {
             VkFormat depthFormat = findDepthFormat(physicalDevice);
             VkImage image = CreateImage(device, images[i].w, images[i].h,
-                depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+                depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
             SetImageObjName(image, images[i].name);
             VkMemoryRequirements memRequirements;
             vkGetImageMemoryRequirements(device, image, &memRequirements);
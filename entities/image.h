@@ -70,6 +70,9 @@ namespace entities {
         VkImageView GetImageView(const std::string& name)const {
             return mImageTable.at(name).mImageView;
         }
+        VkImage GetImage(const std::string& name)const {
+            return mImageTable.at(name).mImage;
+        }
         //const VkContext* mCtx;
     private:
         VkDeviceMemory mDeviceMemory;
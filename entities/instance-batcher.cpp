@@ -0,0 +1,186 @@
+#include "instance-batcher.h"
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include "renderable.h"
+#include "mesh.h"
+#include "transform-store.h"
+#include "vk/my-vk.h"
+#include "vk/my-device.h"
+#include "utils/object_namer.h"
+#include "utils/concatenate.h"
+
+namespace entities {
+    /// <summary>
+    /// Capacity of the instance buffers when the batcher is created.
+    /// </summary>
+    static const uint32_t INITIAL_INSTANCE_CAPACITY = 1024;
+    /// <summary>
+    /// The culling shader writes the indirect commands and the visible ids, and reads the cull instances.
+    /// </summary>
+    static const VkBufferUsageFlags INDIRECT_BUFFER_USAGE = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    static const VkBufferUsageFlags CULL_INSTANCE_BUFFER_USAGE = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    static const VkBufferUsageFlags VISIBLE_ID_BUFFER_USAGE = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    /// <summary>
+    /// Sort key of a draw, from the most to the least significant bits: the page of the object pool
+    /// (the object set), the mesh and the distance to the camera. The same page and mesh end up 
+    /// together and make one batch, and the instances of the batch go front to back so that the 
+    /// depth test rejects more fragments. Pages and meshes past 65535 share keys with others, that
+    /// only splits batches, Build checks the mesh and the set themselves.
+    /// </summary>
+    static uint64_t DrawSortKey(uint32_t page, uint32_t meshIndex, float viewDepth)
+    {
+        //positive floats compare like their bits. Behind the camera, and NaN, go first.
+        const float depth = viewDepth > 0.0f ? viewDepth : 0.0f;
+        uint32_t depthBits;
+        memcpy(&depthBits, &depth, sizeof(depthBits));
+        return (static_cast<uint64_t>(page & 0xFFFF) << 48) |
+            (static_cast<uint64_t>(meshIndex & 0xFFFF) << 32) |
+            depthBits;
+    }
+
+    InstanceBatcher::InstanceBatcher(VkContext* ctx) :mCtx(ctx)
+    {
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+            Reserve(mInstanceBuffers[frame], INITIAL_INSTANCE_CAPACITY, sizeof(uint32_t),
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, "InstanceBuffer", frame);
+            Reserve(mIndirectBuffers[frame], INITIAL_INSTANCE_CAPACITY, sizeof(VkDrawIndexedIndirectCommand),
+                INDIRECT_BUFFER_USAGE, "IndirectBuffer", frame);
+            Reserve(mCullInstanceBuffers[frame], INITIAL_INSTANCE_CAPACITY, sizeof(CullInstance),
+                CULL_INSTANCE_BUFFER_USAGE, "CullInstanceBuffer", frame);
+            Reserve(mVisibleIdBuffers[frame], INITIAL_INSTANCE_CAPACITY, sizeof(uint32_t),
+                VISIBLE_ID_BUFFER_USAGE, "VisibleIdBuffer", frame);
+        }
+    }
+
+    InstanceBatcher::~InstanceBatcher()
+    {
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+            DestroyBuffer(mInstanceBuffers[frame]);
+            DestroyBuffer(mIndirectBuffers[frame]);
+            DestroyBuffer(mCullInstanceBuffers[frame]);
+            DestroyBuffer(mVisibleIdBuffers[frame]);
+        }
+    }
+
+    void InstanceBatcher::DestroyBuffer(MappedBuffer& buffer)
+    {
+        VkDevice device = myvk::Device::gDevice->GetDevice();
+        if (buffer.memory != VK_NULL_HANDLE) {
+            vkUnmapMemory(device, buffer.memory);
+            vkFreeMemory(device, buffer.memory, nullptr);
+        }
+        if (buffer.buffer != VK_NULL_HANDLE)
+            vkDestroyBuffer(device, buffer.buffer, nullptr);
+        buffer = MappedBuffer();
+    }
+
+    void InstanceBatcher::Reserve(MappedBuffer& buffer, uint32_t count, VkDeviceSize elementSize,
+        VkBufferUsageFlags usage, const char* name, uint32_t frame)
+    {
+        if (count <= buffer.capacity)
+            return;
+        //the frame's fence was waited on, nobody is reading the old buffer
+        DestroyBuffer(buffer);
+        uint32_t capacity = INITIAL_INSTANCE_CAPACITY;
+        while (capacity < count)
+            capacity *= 2;
+        const VkDeviceSize size = static_cast<VkDeviceSize>(capacity) * elementSize;
+        CreateBuffer(size, usage,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            buffer.buffer, buffer.memory, *mCtx);
+        SET_NAME(buffer.buffer, VK_OBJECT_TYPE_BUFFER, Concatenate(name, frame).c_str());
+        vkMapMemory(myvk::Device::gDevice->GetDevice(), buffer.memory, 0, size, 0, &buffer.address);
+        buffer.capacity = capacity;
+    }
+
+    const std::vector<InstanceBatch>& InstanceBatcher::Build(uint32_t frame, const std::vector<Renderable*>& renderables,
+        const glm::mat4& view, bool gpuCulling)
+    {
+        mBatches.clear();
+        mIndirectRanges.clear();
+        mGpuCulling = gpuCulling;
+        const uint32_t numberOfInstances = static_cast<uint32_t>(renderables.size());
+        const uint32_t numberOfPhases = gpuCulling ? GPU_CULLING_PHASES : 1;
+        if (gpuCulling) {
+            Reserve(mCullInstanceBuffers[frame], numberOfInstances, sizeof(CullInstance),
+                CULL_INSTANCE_BUFFER_USAGE, "CullInstanceBuffer", frame);
+            Reserve(mVisibleIdBuffers[frame], numberOfInstances * numberOfPhases, sizeof(uint32_t),
+                VISIBLE_ID_BUFFER_USAGE, "VisibleIdBuffer", frame);
+        }
+        else {
+            Reserve(mInstanceBuffers[frame], numberOfInstances, sizeof(uint32_t),
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, "InstanceBuffer", frame);
+        }
+        const TransformStore& transforms = TransformStore::Instance();
+        mKeys.resize(renderables.size());
+        for (uint32_t i = 0; i < renderables.size(); i++) {
+            const Renderable* r = renderables[i];
+            //only the z row of the view matrix is needed, the camera looks down -z
+            const glm::vec3 p = transforms.GetWorldPosition(r->mId);
+            const float viewDepth = -(view[0][2] * p.x + view[1][2] * p.y + view[2][2] * p.z + view[3][2]);
+            mKeys[i].key = DrawSortKey(r->mId / GAME_OBJECTS_PER_PAGE, r->mMesh->mSortIndex, viewDepth);
+            mKeys[i].index = i;
+        }
+        utils::RadixSort(mKeys, mScratchKeys);
+        uint32_t* ids = static_cast<uint32_t*>(mInstanceBuffers[frame].address);
+        CullInstance* cullInstances = static_cast<CullInstance*>(mCullInstanceBuffers[frame].address);
+        for (uint32_t i = 0; i < mKeys.size(); i++) {
+            const Renderable* r = renderables[mKeys[i].index];
+            if (mBatches.empty() || mBatches.back().mesh != r->mMesh ||
+                mBatches.back().objectDescriptorSet != r->GetDescriptorSet()) {
+                InstanceBatch batch;
+                batch.mesh = r->mMesh;
+                batch.objectDescriptorSet = r->GetDescriptorSet();
+                batch.firstInstance = i;
+                mBatches.push_back(batch);
+            }
+            mBatches.back().instanceCount++;
+            if (gpuCulling) {
+                CullInstance& cullInstance = cullInstances[i];
+                cullInstance.localSphere = glm::vec4(r->mMesh->mSphereCenter, r->mMesh->mSphereRadius);
+                cullInstance.objectId = r->mId;
+                cullInstance.command = static_cast<uint32_t>(mBatches.size() - 1);
+            }
+            else {
+                ids[i] = r->mId;
+            }
+        }
+        //one indirect command per batch and phase, the batches of a page are next to each other
+        const uint32_t numberOfBatches = static_cast<uint32_t>(mBatches.size());
+        Reserve(mIndirectBuffers[frame], numberOfBatches * numberOfPhases, sizeof(VkDrawIndexedIndirectCommand),
+            INDIRECT_BUFFER_USAGE, "IndirectBuffer", frame);
+        VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(mIndirectBuffers[frame].address);
+        for (uint32_t i = 0; i < numberOfBatches; i++) {
+            const InstanceBatch& batch = mBatches[i];
+            for (uint32_t phase = 0; phase < numberOfPhases; phase++) {
+                VkDrawIndexedIndirectCommand& command = commands[phase * numberOfBatches + i];
+                command.indexCount = batch.mesh->NumberOfIndices();
+                //the culling shader counts the visible instances itself
+                command.instanceCount = gpuCulling ? 0 : batch.instanceCount;
+                command.firstIndex = batch.mesh->FirstIndex();
+                command.vertexOffset = batch.mesh->VertexOffset();
+                //each phase has its own ids
+                command.firstInstance = phase * numberOfInstances + batch.firstInstance;
+            }
+            if (mIndirectRanges.empty() || mIndirectRanges.back().objectDescriptorSet != batch.objectDescriptorSet) {
+                IndirectDrawRange range;
+                range.objectDescriptorSet = batch.objectDescriptorSet;
+                range.firstCommand = i;
+                range.firstInstance = batch.firstInstance;
+                mIndirectRanges.push_back(range);
+            }
+            mIndirectRanges.back().commandCount++;
+            mIndirectRanges.back().instanceCount += batch.instanceCount;
+        }
+        return mBatches;
+    }
+
+    void InstanceBatcher::Bind(VkCommandBuffer cmd, uint32_t frame) const
+    {
+        VkDeviceSize offset = 0;
+        const VkBuffer& buffer = mGpuCulling ? mVisibleIdBuffers[frame].buffer : mInstanceBuffers[frame].buffer;
+        vkCmdBindVertexBuffers(cmd, 1, 1, &buffer, &offset);
+    }
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/radix-sort.h"
+struct VkContext;
+namespace entities {
+    class Mesh;
+    class Renderable;
+    /// <summary>
+    /// The gpu culling runs twice a frame, see CullingPipeline, and each phase has its own 
+    /// indirect commands and visible ids.
+    /// </summary>
+    const uint32_t GPU_CULLING_PHASES = 2;
+    /// <summary>
+    /// One instanced draw: every renderable of the batch uses the same mesh and lives in the same
+    /// page of the object pool. Their ids are at [firstInstance, firstInstance + instanceCount)
+    /// in the frame's instance buffer.
+    /// </summary>
+    struct InstanceBatch {
+        const Mesh* mesh = nullptr;
+        /// <summary>
+        /// Set 1, the page's descriptor set. Bind it with GameObjectUniformBufferPool::FrameOffset.
+        /// </summary>
+        VkDescriptorSet objectDescriptorSet = VK_NULL_HANDLE;
+        uint32_t firstInstance = 0;
+        uint32_t instanceCount = 0;
+    };
+    /// <summary>
+    /// The indirect draw commands of one page of the object pool: every command in
+    /// [firstCommand, firstCommand + commandCount) of the frame's indirect buffer reads its
+    /// records in objectDescriptorSet.
+    /// </summary>
+    struct IndirectDrawRange {
+        /// <summary>
+        /// Set 1, the page's descriptor set. Bind it with GameObjectUniformBufferPool::FrameOffset.
+        /// </summary>
+        VkDescriptorSet objectDescriptorSet = VK_NULL_HANDLE;
+        uint32_t firstCommand = 0;
+        uint32_t commandCount = 0;
+        /// <summary>
+        /// The instances of all the range's commands, they are contiguous.
+        /// </summary>
+        uint32_t firstInstance = 0;
+        uint32_t instanceCount = 0;
+    };
+    /// <summary>
+    /// What the gpu culling needs to know about an instance. Corresponds to CullInstance in 
+    /// gpu_culling.comp, an element of a std430 array.
+    /// </summary>
+    struct alignas(16) CullInstance {
+        /// <summary>
+        /// The mesh's bounding sphere, center in xyz and radius in w, in the mesh's space.
+        /// </summary>
+        glm::vec4 localSphere;
+        uint32_t objectId;
+        /// <summary>
+        /// Index of the indirect command of the instance's batch.
+        /// </summary>
+        uint32_t command;
+    };
+    /// <summary>
+    /// What a command buffer has bound so far. The draws compare against it and skip the binds
+    /// that wouldn't change anything. Start a new one with each command buffer, and after 
+    /// binding a pipeline.
+    /// </summary>
+    struct BoundDrawState {
+        VkDescriptorSet objectDescriptorSet = VK_NULL_HANDLE;
+    };
+    /// <summary>
+    /// Groups the renderables by page and mesh so that each group is one instanced draw. The order
+    /// comes from radix sorting a key per renderable, see DrawSortKey, so consecutive batches share
+    /// as much state as they can and the instances of a batch go front to back. The ids
+    /// of the instances go to a per-frame host visible buffer that is bound as vertex binding 1,
+    /// the shaders read the object record of each instance with that id.
+    /// It also writes one VkDrawIndexedIndirectCommand per batch to a per-frame indirect buffer,
+    /// so that a pass can draw each page of the pool with a single vkCmdDrawIndexedIndirect.
+    /// When the gpu culls, Build writes a CullInstance per instance instead of the id and leaves
+    /// the instance counts at 0. The culling shader fills the counts and a per-frame buffer of 
+    /// visible ids, and Bind binds that one. The commands and the ids are repeated for each 
+    /// phase of the culling, see GetPhaseCommandOffset.
+    /// The buffers grow when there are more renderables, never shrink.
+    /// </summary>
+    class InstanceBatcher {
+    public:
+        InstanceBatcher(VkContext* ctx);
+        ~InstanceBatcher();
+        InstanceBatcher(const InstanceBatcher&) = delete;
+        InstanceBatcher& operator=(const InstanceBatcher&) = delete;
+        /// <summary>
+        /// Builds the batches of the frame and writes the instance ids and the indirect commands
+        /// to the frame's buffers. The frame's fence must have been waited on. The result is valid
+        /// until the next Build.
+        /// </summary>
+        /// view is the camera's view matrix, for the depth part of the sort keys. With gpuCulling 
+        /// the batches' instance counts are upper bounds, the gpu finds the real ones, so only
+        /// the indirect draws can use the result.
+        const std::vector<InstanceBatch>& Build(uint32_t frame, const std::vector<Renderable*>& renderables,
+            const glm::mat4& view, bool gpuCulling);
+        /// <summary>
+        /// Binds the frame's instance buffer as vertex binding 1, or the visible ids if the last
+        /// Build was for gpu culling.
+        /// </summary>
+        void Bind(VkCommandBuffer cmd, uint32_t frame)const;
+        /// <summary>
+        /// The pages of the last Build, in the order of the indirect buffer.
+        /// </summary>
+        const std::vector<IndirectDrawRange>& GetIndirectRanges()const { return mIndirectRanges; }
+        /// <summary>
+        /// The frame's buffer of VkDrawIndexedIndirectCommand, one per batch of the last Build.
+        /// The commands address the meshes from the start of the global mesh buffer, see
+        /// Mesh::BindGlobalMeshBuffer.
+        /// </summary>
+        VkBuffer GetIndirectBuffer(uint32_t frame)const { return mIndirectBuffers[frame].buffer; }
+        /// <summary>
+        /// Where the commands of a phase of the gpu culling start in the indirect buffer. The 
+        /// indirect ranges are those of phase 0, add this to their firstCommand for the others.
+        /// </summary>
+        uint32_t GetPhaseCommandOffset(uint32_t phase)const { return phase * static_cast<uint32_t>(mBatches.size()); }
+        /// <summary>
+        /// The frame's CullInstance per instance and the buffer where the culling writes the ids 
+        /// of the visible ones. Only filled when the last Build was for gpu culling.
+        /// </summary>
+        VkBuffer GetCullInstanceBuffer(uint32_t frame)const { return mCullInstanceBuffers[frame].buffer; }
+        VkBuffer GetVisibleIdBuffer(uint32_t frame)const { return mVisibleIdBuffers[frame].buffer; }
+    private:
+        /// <summary>
+        /// A host visible and coherent buffer, mapped for as long as it lives.
+        /// </summary>
+        struct MappedBuffer {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            void* address = nullptr;
+            uint32_t capacity = 0;
+        };
+        /// <summary>
+        /// Makes sure the buffer holds count elements of elementSize bytes. name and frame name
+        /// the new buffer.
+        /// </summary>
+        void Reserve(MappedBuffer& buffer, uint32_t count, VkDeviceSize elementSize,
+            VkBufferUsageFlags usage, const char* name, uint32_t frame);
+        void DestroyBuffer(MappedBuffer& buffer);
+        VkContext* mCtx;
+        std::array<MappedBuffer, MAX_FRAMES_IN_FLIGHT> mInstanceBuffers;
+        std::array<MappedBuffer, MAX_FRAMES_IN_FLIGHT> mIndirectBuffers;
+        std::array<MappedBuffer, MAX_FRAMES_IN_FLIGHT> mCullInstanceBuffers;
+        std::array<MappedBuffer, MAX_FRAMES_IN_FLIGHT> mVisibleIdBuffers;
+        bool mGpuCulling = false;
+        std::vector<InstanceBatch> mBatches;
+        std::vector<IndirectDrawRange> mIndirectRanges;
+        /// <summary>
+        /// The sort keys of the renderables and the radix sort's scratch, kept to not allocate 
+        /// every frame.
+        /// </summary>
+        std::vector<utils::SortKey> mKeys;
+        std::vector<utils::SortKey> mScratchKeys;
+    };
+}
@@ -5,10 +5,12 @@
 #include "utils/commandBufferUtils.h"
 #include "vk/my-device.h"
 #include "vk/my-instance.h"
+#include "utils/frame-stats.h"
 #define _256mb 256 * 1024 * 1024
 static VkBuffer gMeshBuffer = VK_NULL_HANDLE;
 static VkDeviceMemory gMeshMemory = VK_NULL_HANDLE;
 uint32_t meshCounter = 0;
+static uint32_t meshSortIndexCounter = 0;
 uintptr_t gMemoryCursor = 0;
 uint32_t _findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkContext ctx) {
     VkPhysicalDeviceMemoryProperties memProperties;
@@ -37,9 +39,13 @@ namespace entities {
     //    CtorCopyDataToGlobalBuffer(vertexes, indices, ctx);
     //    
     //}
-    Mesh::Mesh(io::MeshData& meshData, VkContext* ctx):
-        mCtx(ctx), mName(meshData.name)
+    Mesh::Mesh(std::shared_ptr<const io::MeshData> data, VkContext* ctx):
+        mCtx(ctx), mName(data->name), mSortIndex(meshSortIndexCounter++),
+        mAabbMin(data->aabbMin), mAabbMax(data->aabbMax),
+        mSphereCenter(data->sphereCenter), mSphereRadius(data->sphereRadius),
+        mData(data)
     {
+        const io::MeshData& meshData = *mData;
         CtorStartAssertions();
         //If this is the first mesh then we have to create the infrastructure.
         CtorInitGlobalMeshBuffer(ctx);
@@ -54,7 +60,6 @@ namespace entities {
         }
         std::vector<uint16_t> indices = meshData.indices;
         CtorCopyDataToGlobalBuffer(vertices, indices, ctx);
-
     }
     Mesh::~Mesh()
     {
@@ -68,12 +73,13 @@ namespace entities {
             vkDestroyBuffer(myvk::Device::gDevice->GetDevice(), gMeshBuffer, nullptr);
         }
     }
-    void Mesh::Bind(VkCommandBuffer cmd) const
+    void Mesh::BindGlobalMeshBuffer(VkCommandBuffer cmd)
     {
-        assert(mIndexesOffset != LLONG_MAX);
-        assert(mVertexesOffset != LLONG_MAX);
-        vkCmdBindVertexBuffers(cmd, 0, 1, &gMeshBuffer, &mVertexesOffset);
-        vkCmdBindIndexBuffer(cmd, gMeshBuffer, mIndexesOffset, VK_INDEX_TYPE_UINT16);
+        assert(gMeshBuffer != VK_NULL_HANDLE);
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(cmd, 0, 1, &gMeshBuffer, &offset);
+        vkCmdBindIndexBuffer(cmd, gMeshBuffer, 0, VK_INDEX_TYPE_UINT16);
+        gFrameStats.meshBinds.fetch_add(1, std::memory_order_relaxed);
     }
     void Mesh::CtorStartAssertions()
     {
@@ -147,6 +153,9 @@ namespace entities {
         vkMapMemory(myvk::Device::gDevice->GetDevice(), indexStagingBufferMemory, 0, indexBufferSize, 0, &indexStagingBufferAddress);
         memcpy(indexStagingBufferAddress, indices.data(), (size_t)indexBufferSize);
         vkUnmapMemory(myvk::Device::gDevice->GetDevice(), indexStagingBufferMemory);
+        //the vertices start at a whole vertex so that VertexOffset can address them from the start
+        //of the buffer. The index sizes are even, the indices are always aligned.
+        gMemoryCursor = (gMemoryCursor + sizeof(Vertex) - 1) / sizeof(Vertex) * sizeof(Vertex);
         assert(gMemoryCursor + vertexBufferSize + indexBufferSize < _256mb); //Is there enough space?
         //3)Copy the vertex and index buffer to the main buffer, increase the cursor
         VkCommandBuffer vbCopyCommandBuffer = CreateCommandBuffer(myvk::Device::gDevice->GetCommandPool(),
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 #include <vector>
 #include <array>
+#include <memory>
 #include "io/mesh-data.h"
 struct VkContext;
 
@@ -20,14 +21,50 @@ namespace entities {
         //     const std::vector<uint16_t>& indices,
         //     VkContext* ctx,
         //     const std::string& name);
-        Mesh(io::MeshData& meshData, VkContext* ctx);
+        /// <summary>
+        /// Uploads the mesh to the global mesh buffer and keeps meshData, for the queries against
+        /// the triangles.
+        /// </summary>
+        Mesh(std::shared_ptr<const io::MeshData> meshData, VkContext* ctx);
         ~Mesh();
         const VkContext* mCtx;
         const std::string mName;
-        void Bind(VkCommandBuffer cmd)const;
+        /// <summary>
+        /// Order of creation, the mesh's part of the draw sort keys.
+        /// </summary>
+        const uint32_t mSortIndex;
+        /// <summary>
+        /// Bounds of the vertices, in the mesh's space. See io::MeshData.
+        /// </summary>
+        const glm::vec3 mAabbMin;
+        const glm::vec3 mAabbMax;
+        const glm::vec3 mSphereCenter;
+        const float mSphereRadius;
+        /// <summary>
+        /// The vertices and indices on the cpu side, with the bvh over the triangles. For ray picking.
+        /// </summary>
+        const std::shared_ptr<const io::MeshData> mData;
+        /// <summary>
+        /// Binds the whole global mesh buffer as vertex binding 0 and as index buffer, at offset 0.
+        /// Every mesh lives there, so it's bound once per pass and the draws pick the mesh with 
+        /// FirstIndex and VertexOffset.
+        /// </summary>
+        static void BindGlobalMeshBuffer(VkCommandBuffer cmd);
         uint16_t NumberOfIndices()const {
             return mNumberOfIndices;
         }
+        /// <summary>
+        /// Index of the mesh's first index in the global mesh buffer, in indices.
+        /// </summary>
+        uint32_t FirstIndex()const {
+            return static_cast<uint32_t>(mIndexesOffset / sizeof(uint16_t));
+        }
+        /// <summary>
+        /// Index of the mesh's first vertex in the global mesh buffer, in vertices.
+        /// </summary>
+        int32_t VertexOffset()const {
+            return static_cast<int32_t>(mVertexesOffset / sizeof(Vertex));
+        }
     private:
         void CtorStartAssertions();
         void CtorInitGlobalMeshBuffer(VkContext* ctx);
@@ -6,7 +6,10 @@
 #include "utils/object_namer.h"
 #include "renderable.h"
 #include "mesh.h"
+#include "instance-batcher.h"
 #include "vk/my-device.h"
+#include "utils/frame-stats.h"
+#include "vk/my-gpu-profiler.h"
 namespace entities {
     VkShaderModule Pipeline::LoadShaderModule(VkDevice device, const std::string& name)
     {
@@ -50,14 +53,18 @@ namespace entities {
         dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
         dynamicState.pDynamicStates = dynamicStates.data();
         //vertex input description
-        auto bindingDescription = GetBindingDescription();
-        auto attributeDescriptions = GetAttributeDescriptions();
-
+        //binding 0 is the mesh, binding 1 the object id of each instance
+        std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {
+            GetBindingDescription(), GetInstanceBindingDescription() };
+        auto meshAttributeDescriptions = GetAttributeDescriptions();
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(
+            meshAttributeDescriptions.begin(), meshAttributeDescriptions.end());
+        attributeDescriptions.push_back(GetInstanceAttributeDescription());
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
         vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
         vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
         //input description: the geometry input will be triangles
         VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
@@ -180,24 +187,9 @@ namespace entities {
     {
         vkCmdBindPipeline(cmd,
             VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    }
-    void Pipeline::DrawRenderable(Renderable* go,
-        CameraUniformBuffer* camera,
-        VkCommandBuffer cmdBuffer)
-    {
-        static PFN_vkCmdDebugMarkerEndEXT __vkCmdDebugMarkerEndEXT;
-        if (__vkCmdDebugMarkerEndEXT == VK_NULL_HANDLE) {
-            __vkCmdDebugMarkerEndEXT = (PFN_vkCmdDebugMarkerEndEXT)vkGetDeviceProcAddr(myvk::Device::gDevice->GetDevice(), "vkCmdDebugMarkerEndEXT");
-        }
-        SetMark({ 1.0f, 0.0f, 0.0f, 1.0f }, go->mName, cmdBuffer, *mCtx);
-        //copies camera data to gpu
-        memcpy(mCtx->helloCameraUniformBufferAddress[mCtx->currentFrame], camera, sizeof(CameraUniformBuffer));
-        //copies object data to gpu
-        go->CommitDataToObjectBuffer(mCtx->currentFrame);
-        go->mMesh->Bind(cmdBuffer);
-        //bind the camera descriptor set
+        //bind the camera descriptor set, once for the whole pass
         vkCmdBindDescriptorSets(
-            cmdBuffer,
+            cmd,
             VK_PIPELINE_BIND_POINT_GRAPHICS,   // We assume it's a graphics pipeline
             pipelineLayout,                    // The pipeline layout that matches the shader's descriptor set layouts
             0,                                 // firstSet, which is the index of the first descriptor set (set = 0)
@@ -206,23 +198,9 @@ namespace entities {
             0,                                 // dynamicOffsetCount, assuming no dynamic offsets
             nullptr                            // pDynamicOffsets, assuming no dynamic offsets
         );
-        //bind the object-specific descriptor set
-        // Bind the object-specific descriptor set (set = 1)
-        VkDescriptorSet objectDescriptorSet = go->GetDescriptorSet(mCtx->currentFrame);
-        uint32_t dynamicOffset = go->DynamicOffset(mCtx->currentFrame);
-        vkCmdBindDescriptorSets(
-            cmdBuffer,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelineLayout,
-            1,                                 // firstSet, index of the first descriptor set (set = 1)
-            1,                                 // descriptorSetCount, number of descriptor sets to bind
-            &objectDescriptorSet,              // Pointer to the array of descriptor sets (only one in this case)
-            1,
-            &dynamicOffset
-        );
         //bind the sampler
         vkCmdBindDescriptorSets(
-            cmdBuffer,
+            cmd,
             VK_PIPELINE_BIND_POINT_GRAPHICS,
             pipelineLayout,
             2, //third set
@@ -231,13 +209,71 @@ namespace entities {
             0,
             nullptr
         );
-        //Draw command
+        gFrameStats.pipelineBinds.fetch_add(1, std::memory_order_relaxed);
+        gFrameStats.descriptorSetBinds.fetch_add(2, std::memory_order_relaxed);
+    }
+    void Pipeline::DrawBatch(const InstanceBatch& batch,
+        VkCommandBuffer cmdBuffer, BoundDrawState& bound)
+    {
+        SetMark({ 1.0f, 0.0f, 0.0f, 1.0f }, batch.mesh->mName, cmdBuffer, *mCtx);
+        uint32_t drawScope = myvk::GpuProfiler::BeginDrawScope(cmdBuffer, batch.mesh->mName);
+        //the objects' records were written by the transform update phase, see UpdateTransforms
+        // Bind the page's descriptor set (set = 1), the instances pick their records in it. The 
+        // frame's offset is the same for every page, only the set can change.
+        if (bound.objectDescriptorSet != batch.objectDescriptorSet) {
+            uint32_t dynamicOffset = GameObjectUniformBufferPool::FrameOffset(mCtx->currentFrame);
+            vkCmdBindDescriptorSets(
+                cmdBuffer,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipelineLayout,
+                1,                                 // firstSet, index of the first descriptor set (set = 1)
+                1,                                 // descriptorSetCount, number of descriptor sets to bind
+                &batch.objectDescriptorSet,        // Pointer to the array of descriptor sets (only one in this case)
+                1,
+                &dynamicOffset
+            );
+            bound.objectDescriptorSet = batch.objectDescriptorSet;
+            gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+        }
+        //Draw command, one instance per object
         vkCmdDrawIndexed(cmdBuffer,
-            static_cast<uint32_t>(go->mMesh->NumberOfIndices()),
+            static_cast<uint32_t>(batch.mesh->NumberOfIndices()),
+            batch.instanceCount,
+            batch.mesh->FirstIndex(),
+            batch.mesh->VertexOffset(),
+            batch.firstInstance);
+        gFrameStats.drawCalls.fetch_add(1, std::memory_order_relaxed);
+        myvk::GpuProfiler::EndDrawScope(cmdBuffer, drawScope);
+        EndMark(cmdBuffer);
+    }
+
+    void Pipeline::DrawIndirect(const IndirectDrawRange& range, VkBuffer indirectBuffer, VkCommandBuffer cmdBuffer)
+    {
+        // Bind the page's descriptor set (set = 1), every command of the range reads its records in it
+        uint32_t dynamicOffset = GameObjectUniformBufferPool::FrameOffset(mCtx->currentFrame);
+        vkCmdBindDescriptorSets(
+            cmdBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipelineLayout,
             1,
-            0,
-            0,
-            0);
-        __vkCmdDebugMarkerEndEXT(cmdBuffer);
+            1,
+            &range.objectDescriptorSet,
+            1,
+            &dynamicOffset
+        );
+        gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        const VkDeviceSize offset = static_cast<VkDeviceSize>(range.firstCommand) * stride;
+        if (myvk::Device::gDevice->GetEnabledFeatures().multiDrawIndirect) {
+            vkCmdDrawIndexedIndirect(cmdBuffer, indirectBuffer, offset, range.commandCount, stride);
+            gFrameStats.drawCalls.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            //without multiDrawIndirect the draw count can only be 1
+            for (uint32_t i = 0; i < range.commandCount; i++) {
+                vkCmdDrawIndexedIndirect(cmdBuffer, indirectBuffer, offset + i * stride, 1, stride);
+            }
+            gFrameStats.drawCalls.fetch_add(range.commandCount, std::memory_order_relaxed);
+        }
     }
 }
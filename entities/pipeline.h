@@ -6,6 +6,9 @@ struct VkContext;
 struct CameraUniformBuffer;
 namespace entities {
     class Renderable;
+    struct InstanceBatch;
+    struct IndirectDrawRange;
+    struct BoundDrawState;
 
     class Pipeline {
     public:
@@ -28,9 +31,25 @@ namespace entities {
         const VkRenderPass mRenderPass;
         VkPipeline GetPipeline()const { return pipeline; }
         VkPipelineLayout GetPipelineLayout()const { return pipelineLayout; }
+        /// <summary>
+        /// Binds the pipeline and the sets that don't change during the pass: the camera (set 0) 
+        /// and the sampler (set 2). UpdateFrameGlobals must have been called for the frame.
+        /// </summary>
         void Bind(VkCommandBuffer cmd);
-        void DrawRenderable(Renderable* obj, CameraUniformBuffer* camera,
-            VkCommandBuffer cmd);
+        /// <summary>
+        /// Records the instanced draw of a batch: binds the page's object set, unless bound says 
+        /// it already is, and draws the mesh once per object. The frame's instance buffer and the 
+        /// global mesh buffer must be bound, see InstanceBatcher::Bind and Mesh::BindGlobalMeshBuffer.
+        /// </summary>
+        void DrawBatch(const InstanceBatch& batch, VkCommandBuffer cmd, BoundDrawState& bound);
+        /// <summary>
+        /// Records the indirect draws of a page: binds the page's object set and draws the range's
+        /// commands of indirectBuffer, one vkCmdDrawIndexedIndirect when the device has
+        /// multiDrawIndirect, one per command otherwise. The frame's instance buffer and the global 
+        /// mesh buffer must be bound, see InstanceBatcher::Bind and Mesh::BindGlobalMeshBuffer.
+        /// Requires drawIndirectFirstInstance.
+        /// </summary>
+        void DrawIndirect(const IndirectDrawRange& range, VkBuffer indirectBuffer, VkCommandBuffer cmd);
     private:
         VkShaderModule vertexShaderModule = VK_NULL_HANDLE;
         VkShaderModule fragmentShaderModule = VK_NULL_HANDLE;
@@ -0,0 +1,53 @@
+#include "ray-picking.h"
+#include <limits>
+#include "mesh.h"
+#include "transform-store.h"
+
+namespace entities {
+    Ray RayThroughPixel(const glm::mat4& view, const glm::mat4& proj, const glm::vec2& pixel,
+        const glm::vec2& viewportSize)
+    {
+        //vulkan's y goes down like the window's, the flipped projection takes care of it
+        const float x = 2.0f * pixel.x / viewportSize.x - 1.0f;
+        const float y = 2.0f * pixel.y / viewportSize.y - 1.0f;
+        const glm::mat4 inverseViewProjection = glm::inverse(proj * view);
+        glm::vec4 nearPoint = inverseViewProjection * glm::vec4(x, y, 0.0f, 1.0f);
+        glm::vec4 farPoint = inverseViewProjection * glm::vec4(x, y, 1.0f, 1.0f);
+        nearPoint /= nearPoint.w;
+        farPoint /= farPoint.w;
+        Ray ray;
+        ray.origin = glm::vec3(nearPoint);
+        ray.direction = glm::normalize(glm::vec3(farPoint) - glm::vec3(nearPoint));
+        return ray;
+    }
+
+    PickResult PickObject(const SceneBvh& bvh, const Ray& ray, float maxDistance,
+        const std::function<const Mesh*(uint32_t id)>& meshOf)
+    {
+        const TransformStore& store = TransformStore::Instance();
+        PickResult result;
+        //the test is only called with what would be closer than the closest so far, so any hit
+        //it finds is the new closest
+        auto hitTriangles = [&](uint32_t id, float closest) -> float {
+            const Mesh* mesh = meshOf(id);
+            if (mesh == nullptr || mesh->mData == nullptr)
+                return std::numeric_limits<float>::infinity();
+            //to the mesh's space. The matrix is affine, the distances along the ray don't change.
+            const glm::mat4 toMesh = glm::inverse(store.GetWorldMatrix(id));
+            const glm::vec3 origin = glm::vec3(toMesh * glm::vec4(ray.origin, 1.0f));
+            const glm::vec3 direction = glm::vec3(toMesh * glm::vec4(ray.direction, 0.0f));
+            io::TriangleHit hit;
+            if (!mesh->mData->bvh.Intersect(*mesh->mData, origin, direction, closest, hit))
+                return std::numeric_limits<float>::infinity();
+            result.triangle = hit.triangle;
+            return hit.distance;
+        };
+        float distance;
+        result.objectId = bvh.CastRay(ray, maxDistance, hitTriangles, distance);
+        if (result.objectId != NO_OBJECT) {
+            result.distance = distance * glm::length(ray.direction);
+            result.position = ray.origin + ray.direction * distance;
+        }
+        return result;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+#include "scene-bvh.h"
+namespace entities {
+    class Mesh;
+    /// <summary>
+    /// The object under the cursor. objectId is NO_OBJECT if there's none. The gpu picker only
+    /// knows the object, triangle and position are filled by the cpu picking.
+    /// </summary>
+    struct PickResult {
+        uint32_t objectId = NO_OBJECT;
+        /// <summary>
+        /// Index of the triangle in the mesh's index list, divided by 3.
+        /// </summary>
+        uint32_t triangle = 0;
+        /// <summary>
+        /// Distance from the camera, in world units, and the hit point in world space.
+        /// </summary>
+        float distance = 0.0f;
+        glm::vec3 position = glm::vec3(0.0f);
+    };
+    /// <summary>
+    /// The ray from the camera through a pixel, in world space, with a normalized direction.
+    /// pixel is in window coordinates, origin at the top left like the cursor's, and the
+    /// projection must have y flipped for vulkan and depth in [0, 1], like the camera's. The ray
+    /// starts at the near plane.
+    /// </summary>
+    Ray RayThroughPixel(const glm::mat4& view, const glm::mat4& proj, const glm::vec2& pixel,
+        const glm::vec2& viewportSize);
+    /// <summary>
+    /// Casts the ray against the objects of the bvh and then against the triangles of the mesh of
+    /// each object the ray gets to, closest first, see SceneBvh::CastRay. meshOf gives the mesh
+    /// of an id, objects without one can't be picked. The world matrices come from the TransformStore.
+    /// </summary>
+    PickResult PickObject(const SceneBvh& bvh, const Ray& ray, float maxDistance,
+        const std::function<const Mesh*(uint32_t id)>& meshOf);
+}
@@ -1,8 +1,11 @@
 #include "renderable.h"
+#include "mesh.h"
 namespace entities {
     Renderable::Renderable(VkContext* ctx, const std::string& name, const Mesh* mesh)
         :GameObject(ctx, name), mMesh(mesh)
     {
         assert(mesh != nullptr);
+        //culling tests the mesh's sphere moved with the object
+        TransformStore::Instance().SetLocalBounds(mId, mesh->mSphereCenter, mesh->mSphereRadius);
     }
 }
@@ -0,0 +1,568 @@
+#include "scene-bvh.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace entities {
+    /// <summary>
+    /// The leaves are the spheres' boxes grown by this fraction of the radius, objects that move
+    /// less than that stay in their leaf and cost nothing to refit.
+    /// </summary>
+    static const float LEAF_MARGIN = 0.1f;
+    /// <summary>
+    /// Number of bins of the SAH build along the split axis.
+    /// </summary>
+    static const uint32_t SAH_BINS = 16;
+    /// <summary>
+    /// Refit rebuilds the tree once the inserts and removes since the last Build are more than
+    /// this fraction of the objects, the incremental inserts make worse trees than the build.
+    /// </summary>
+    static const float REBUILD_FRACTION = 0.5f;
+    static const uint32_t NO_NODE = UINT32_MAX;
+    static const float INFINITE_DISTANCE = std::numeric_limits<float>::infinity();
+
+    static Aabb SphereBox(const glm::vec4& sphere)
+    {
+        const glm::vec3 center(sphere);
+        return { center - sphere.w, center + sphere.w };
+    }
+
+    static Aabb LeafBox(const glm::vec4& sphere)
+    {
+        return SphereBox(glm::vec4(glm::vec3(sphere), sphere.w * (1.0f + LEAF_MARGIN)));
+    }
+
+    static Aabb Union(const Aabb& a, const Aabb& b)
+    {
+        return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    }
+
+    static float SurfaceArea(const Aabb& box)
+    {
+        const glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static bool Encloses(const Aabb& outer, const Aabb& inner)
+    {
+        return glm::all(glm::lessThanEqual(outer.min, inner.min)) &&
+            glm::all(glm::greaterThanEqual(outer.max, inner.max));
+    }
+
+    static bool Overlaps(const Aabb& a, const Aabb& b)
+    {
+        return glm::all(glm::lessThanEqual(a.min, b.max)) &&
+            glm::all(glm::lessThanEqual(b.min, a.max));
+    }
+
+    static bool SameBox(const Aabb& a, const Aabb& b)
+    {
+        return a.min == b.min && a.max == b.max;
+    }
+
+    /// <summary>
+    /// Slab test. inverseDirection is 1 / direction, per component. tEnter gets where the ray
+    /// enters the box, 0 if it starts inside.
+    /// </summary>
+    static bool RayHitsBox(const Aabb& box, const glm::vec3& origin, const glm::vec3& inverseDirection,
+        float maxDistance, float& tEnter)
+    {
+        const glm::vec3 t0 = (box.min - origin) * inverseDirection;
+        const glm::vec3 t1 = (box.max - origin) * inverseDirection;
+        const glm::vec3 tNear = glm::min(t0, t1);
+        const glm::vec3 tFar = glm::max(t0, t1);
+        tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return tEnter <= tExit;
+    }
+
+    /// <summary>
+    /// Where the ray enters the sphere, 0 if it starts inside, infinity if it misses.
+    /// </summary>
+    static float RayHitsSphere(const Ray& ray, const glm::vec4& sphere)
+    {
+        const glm::vec3 oc = ray.origin - glm::vec3(sphere);
+        const float c = glm::dot(oc, oc) - sphere.w * sphere.w;
+        if (c <= 0.0f)
+            return 0.0f;
+        const float a = glm::dot(ray.direction, ray.direction);
+        const float b = glm::dot(oc, ray.direction);
+        const float discriminant = b * b - a * c;
+        if (b >= 0.0f || discriminant < 0.0f || a == 0.0f)
+            return INFINITE_DISTANCE;
+        return (-b - std::sqrt(discriminant)) / a;
+    }
+
+    enum class FrustumOverlap { Outside, Intersects, Inside };
+
+    /// <summary>
+    /// Tests the box corner farthest along each plane's normal, then the nearest one.
+    /// </summary>
+    static FrustumOverlap ClassifyBox(const Frustum& frustum, const Aabb& box)
+    {
+        FrustumOverlap result = FrustumOverlap::Inside;
+        for (const auto& plane : frustum.planes) {
+            const glm::vec3 normal(plane);
+            const glm::vec3 farthest(normal.x >= 0 ? box.max.x : box.min.x,
+                normal.y >= 0 ? box.max.y : box.min.y,
+                normal.z >= 0 ? box.max.z : box.min.z);
+            if (glm::dot(normal, farthest) + plane.w < 0.0f)
+                return FrustumOverlap::Outside;
+            const glm::vec3 nearest(normal.x >= 0 ? box.min.x : box.max.x,
+                normal.y >= 0 ? box.min.y : box.max.y,
+                normal.z >= 0 ? box.min.z : box.max.z);
+            if (glm::dot(normal, nearest) + plane.w < 0.0f)
+                result = FrustumOverlap::Intersects;
+        }
+        return result;
+    }
+
+    uint32_t SceneBvh::AllocateNode()
+    {
+        uint32_t index;
+        if (!mFreeNodes.empty()) {
+            index = mFreeNodes.back();
+            mFreeNodes.pop_back();
+        }
+        else {
+            index = static_cast<uint32_t>(mNodes.size());
+            mNodes.emplace_back();
+        }
+        mNodes[index] = Node();
+        return index;
+    }
+
+    void SceneBvh::FreeNode(uint32_t index)
+    {
+        mNodes[index] = Node();
+        mFreeNodes.push_back(index);
+    }
+
+    void SceneBvh::Insert(uint32_t id, const glm::vec3& center, float radius)
+    {
+        assert(!Contains(id));
+        if (id >= mLeafOfObject.size()) {
+            mLeafOfObject.resize(id + 1, NO_NODE);
+            mSpheres.resize(id + 1);
+        }
+        mSpheres[id] = glm::vec4(center, radius);
+        const uint32_t leaf = AllocateNode();
+        mNodes[leaf].bounds = LeafBox(mSpheres[id]);
+        mNodes[leaf].objectId = id;
+        mLeafOfObject[id] = leaf;
+        InsertLeaf(leaf);
+        mNumberOfObjects++;
+        mChangesSinceBuild++;
+    }
+
+    void SceneBvh::Insert(const std::vector<uint32_t>& ids, const BoundsArrays& bounds)
+    {
+        if (ids.size() <= mNumberOfObjects) {
+            for (uint32_t id : ids)
+                Insert(id, glm::vec3(bounds.x[id], bounds.y[id], bounds.z[id]), bounds.radius[id]);
+            return;
+        }
+        //Build makes the leaves of every object that has a sphere
+        for (uint32_t id : ids) {
+            assert(!Contains(id));
+            if (id >= mLeafOfObject.size()) {
+                mLeafOfObject.resize(id + 1, NO_NODE);
+                mSpheres.resize(id + 1);
+            }
+            mSpheres[id] = glm::vec4(bounds.x[id], bounds.y[id], bounds.z[id], bounds.radius[id]);
+            //anything but NO_NODE, Build gives it its real leaf
+            mLeafOfObject[id] = 0;
+        }
+        mNumberOfObjects += static_cast<uint32_t>(ids.size());
+        Build();
+    }
+
+    void SceneBvh::Remove(uint32_t id)
+    {
+        if (!Contains(id))
+            return;
+        const uint32_t leaf = mLeafOfObject[id];
+        RemoveLeaf(leaf);
+        FreeNode(leaf);
+        mLeafOfObject[id] = NO_NODE;
+        mNumberOfObjects--;
+        mChangesSinceBuild++;
+    }
+
+    void SceneBvh::InsertLeaf(uint32_t leaf)
+    {
+        if (mRoot == NO_NODE) {
+            mRoot = leaf;
+            mNodes[leaf].parent = NO_NODE;
+            return;
+        }
+        //go down towards the child that grows the least until making a new parent here is cheaper
+        const Aabb leafBounds = mNodes[leaf].bounds;
+        uint32_t sibling = mRoot;
+        while (!mNodes[sibling].IsLeaf()) {
+            const Node& node = mNodes[sibling];
+            const float area = SurfaceArea(node.bounds);
+            const float combinedArea = SurfaceArea(Union(node.bounds, leafBounds));
+            const float cost = 2.0f * combinedArea;
+            //every ancestor of the new parent grows by this much
+            const float inheritedCost = 2.0f * (combinedArea - area);
+            float childCosts[2];
+            for (uint32_t c = 0; c < 2; c++) {
+                const Node& child = mNodes[node.children[c]];
+                const float grownArea = SurfaceArea(Union(child.bounds, leafBounds));
+                childCosts[c] = (child.IsLeaf() ? grownArea : grownArea - SurfaceArea(child.bounds)) + inheritedCost;
+            }
+            if (cost < childCosts[0] && cost < childCosts[1])
+                break;
+            sibling = childCosts[0] < childCosts[1] ? node.children[0] : node.children[1];
+        }
+        const uint32_t oldParent = mNodes[sibling].parent;
+        const uint32_t newParent = AllocateNode();
+        mNodes[newParent].parent = oldParent;
+        mNodes[newParent].bounds = Union(mNodes[sibling].bounds, leafBounds);
+        mNodes[newParent].children[0] = sibling;
+        mNodes[newParent].children[1] = leaf;
+        mNodes[sibling].parent = newParent;
+        mNodes[leaf].parent = newParent;
+        if (oldParent == NO_NODE) {
+            mRoot = newParent;
+            return;
+        }
+        Node& parent = mNodes[oldParent];
+        parent.children[parent.children[0] == sibling ? 0 : 1] = newParent;
+        RefitAncestors(oldParent);
+    }
+
+    void SceneBvh::RemoveLeaf(uint32_t leaf)
+    {
+        if (leaf == mRoot) {
+            mRoot = NO_NODE;
+            return;
+        }
+        //the sibling takes the parent's place
+        const uint32_t parent = mNodes[leaf].parent;
+        const uint32_t grandParent = mNodes[parent].parent;
+        const uint32_t sibling = mNodes[parent].children[0] == leaf ?
+            mNodes[parent].children[1] : mNodes[parent].children[0];
+        mNodes[sibling].parent = grandParent;
+        FreeNode(parent);
+        mNodes[leaf].parent = NO_NODE;
+        if (grandParent == NO_NODE) {
+            mRoot = sibling;
+            return;
+        }
+        Node& node = mNodes[grandParent];
+        node.children[node.children[0] == parent ? 0 : 1] = sibling;
+        RefitAncestors(grandParent);
+    }
+
+    void SceneBvh::RefitAncestors(uint32_t index)
+    {
+        while (index != NO_NODE) {
+            Node& node = mNodes[index];
+            const Aabb bounds = Union(mNodes[node.children[0]].bounds, mNodes[node.children[1]].bounds);
+            //the ones above were made from this box, they are still right
+            if (SameBox(bounds, node.bounds))
+                return;
+            node.bounds = bounds;
+            index = node.parent;
+        }
+    }
+
+    void SceneBvh::Build()
+    {
+        //the leaves' boxes and centroids side by side, the split sorts these and not the nodes
+        struct BuildItem {
+            Aabb bounds;
+            glm::vec3 centroid;
+            uint32_t leaf;
+        };
+        std::vector<BuildItem> items;
+        items.reserve(mNumberOfObjects);
+        mNodes.clear();
+        mFreeNodes.clear();
+        mRoot = NO_NODE;
+        mChangesSinceBuild = 0;
+        if (mNumberOfObjects == 0)
+            return;
+        //n leaves and n - 1 inner nodes, no reallocation while building
+        mNodes.reserve(2 * mNumberOfObjects - 1);
+        for (uint32_t id = 0; id < mLeafOfObject.size(); id++) {
+            if (mLeafOfObject[id] == NO_NODE)
+                continue;
+            const uint32_t leaf = AllocateNode();
+            mNodes[leaf].bounds = LeafBox(mSpheres[id]);
+            mNodes[leaf].objectId = id;
+            mLeafOfObject[id] = leaf;
+            const Aabb& bounds = mNodes[leaf].bounds;
+            items.push_back({ bounds, (bounds.min + bounds.max) * 0.5f, leaf });
+        }
+        //the ranges of items still to split, with where to hang the node made from them
+        struct BuildTask {
+            uint32_t begin, end;
+            uint32_t parent, slot;
+        };
+        std::vector<BuildTask> tasks;
+        tasks.push_back({ 0, static_cast<uint32_t>(items.size()), NO_NODE, 0 });
+        while (!tasks.empty()) {
+            const BuildTask task = tasks.back();
+            tasks.pop_back();
+            uint32_t index;
+            if (task.end - task.begin == 1) {
+                index = items[task.begin].leaf;
+            }
+            else {
+                Aabb centroidBounds = { items[task.begin].centroid, items[task.begin].centroid };
+                for (uint32_t i = task.begin + 1; i < task.end; i++) {
+                    centroidBounds.min = glm::min(centroidBounds.min, items[i].centroid);
+                    centroidBounds.max = glm::max(centroidBounds.max, items[i].centroid);
+                }
+                index = AllocateNode();
+                //split along the longest axis of the centroids
+                const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+                const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+                uint32_t middle = task.begin;
+                if (extent[axis] > 0.0f) {
+                    const float scale = SAH_BINS / extent[axis];
+                    const float axisMin = centroidBounds.min[axis];
+                    auto binOf = [&](const BuildItem& item) {
+                        const uint32_t bin = static_cast<uint32_t>((item.centroid[axis] - axisMin) * scale);
+                        return std::min(bin, SAH_BINS - 1);
+                    };
+                    Aabb binBounds[SAH_BINS];
+                    uint32_t binCounts[SAH_BINS] = {};
+                    for (uint32_t i = task.begin; i < task.end; i++) {
+                        const uint32_t bin = binOf(items[i]);
+                        binBounds[bin] = binCounts[bin] == 0 ? items[i].bounds : Union(binBounds[bin], items[i].bounds);
+                        binCounts[bin]++;
+                    }
+                    //cost of splitting after each bin, the left side swept forward and the right backwards.
+                    //The first and last bins aren't empty, the left sweep ends up with the node's box.
+                    float leftCosts[SAH_BINS - 1];
+                    Aabb sideBounds = binBounds[0];
+                    uint32_t sideCount = 0;
+                    for (uint32_t b = 0; b < SAH_BINS; b++) {
+                        if (binCounts[b] > 0) {
+                            sideBounds = Union(sideBounds, binBounds[b]);
+                            sideCount += binCounts[b];
+                        }
+                        if (b < SAH_BINS - 1)
+                            leftCosts[b] = sideCount * SurfaceArea(sideBounds);
+                    }
+                    mNodes[index].bounds = sideBounds;
+                    float bestCost = INFINITE_DISTANCE;
+                    uint32_t bestBin = 0;
+                    sideBounds = binBounds[SAH_BINS - 1];
+                    sideCount = 0;
+                    for (uint32_t b = SAH_BINS - 1; b > 0; b--) {
+                        if (binCounts[b] > 0) {
+                            sideBounds = Union(sideBounds, binBounds[b]);
+                            sideCount += binCounts[b];
+                        }
+                        const float cost = leftCosts[b - 1] + sideCount * SurfaceArea(sideBounds);
+                        if (cost < bestCost) {
+                            bestCost = cost;
+                            bestBin = b - 1;
+                        }
+                    }
+                    middle = static_cast<uint32_t>(std::partition(items.begin() + task.begin, items.begin() + task.end,
+                        [&](const BuildItem& item) { return binOf(item) <= bestBin; }) - items.begin());
+                }
+                else {
+                    Aabb bounds = items[task.begin].bounds;
+                    for (uint32_t i = task.begin + 1; i < task.end; i++)
+                        bounds = Union(bounds, items[i].bounds);
+                    mNodes[index].bounds = bounds;
+                }
+                //all the centroids in one place, any half will do
+                if (middle == task.begin || middle == task.end)
+                    middle = task.begin + (task.end - task.begin) / 2;
+                tasks.push_back({ middle, task.end, index, 1 });
+                tasks.push_back({ task.begin, middle, index, 0 });
+            }
+            mNodes[index].parent = task.parent;
+            if (task.parent == NO_NODE)
+                mRoot = index;
+            else
+                mNodes[task.parent].children[task.slot] = index;
+        }
+    }
+
+    uint32_t SceneBvh::Refit(const BoundsArrays& bounds)
+    {
+        uint32_t moved = 0;
+        for (uint32_t id = 0; id < mLeafOfObject.size(); id++) {
+            const uint32_t leaf = mLeafOfObject[id];
+            if (leaf == NO_NODE)
+                continue;
+            const glm::vec4 sphere(bounds.x[id], bounds.y[id], bounds.z[id], bounds.radius[id]);
+            //most objects don't move, they don't need to touch the node
+            if (sphere == mSpheres[id])
+                continue;
+            mSpheres[id] = sphere;
+            if (Encloses(mNodes[leaf].bounds, SphereBox(sphere)))
+                continue;
+            mNodes[leaf].bounds = LeafBox(sphere);
+            RefitAncestors(mNodes[leaf].parent);
+            moved++;
+        }
+        if (mChangesSinceBuild > 0 && mChangesSinceBuild >= mNumberOfObjects * REBUILD_FRACTION)
+            Build();
+        return moved;
+    }
+
+    void SceneBvh::CollectObjects(uint32_t index, std::vector<uint32_t>& ids, std::vector<uint32_t>& stack)const
+    {
+        stack.clear();
+        stack.push_back(index);
+        while (!stack.empty()) {
+            const Node& node = mNodes[stack.back()];
+            stack.pop_back();
+            if (node.IsLeaf()) {
+                ids.push_back(node.objectId);
+                continue;
+            }
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+
+    void SceneBvh::QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& ids)const
+    {
+        if (mRoot == NO_NODE)
+            return;
+        std::vector<uint32_t> stack{ mRoot };
+        std::vector<uint32_t> subtreeStack;
+        //the leaves whose box crosses a plane, their spheres are tested together at the end
+        std::vector<uint32_t> candidates;
+        while (!stack.empty()) {
+            const uint32_t index = stack.back();
+            stack.pop_back();
+            const Node& node = mNodes[index];
+            const FrustumOverlap overlap = ClassifyBox(frustum, node.bounds);
+            if (overlap == FrustumOverlap::Outside)
+                continue;
+            //the whole subtree is in, no more tests
+            if (overlap == FrustumOverlap::Inside) {
+                CollectObjects(index, ids, subtreeStack);
+                continue;
+            }
+            if (node.IsLeaf()) {
+                candidates.push_back(node.objectId);
+                continue;
+            }
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+        if (candidates.empty())
+            return;
+        //gathered in arrays for CullSpheresSimd, padded to a whole block of 4
+        const uint32_t count = static_cast<uint32_t>(candidates.size());
+        const uint32_t padded = (count + 3) & ~3u;
+        std::vector<float> x(padded, 0.0f), y(padded, 0.0f), z(padded, 0.0f), radius(padded, 0.0f);
+        for (uint32_t i = 0; i < count; i++) {
+            const glm::vec4& sphere = mSpheres[candidates[i]];
+            x[i] = sphere.x;
+            y[i] = sphere.y;
+            z[i] = sphere.z;
+            radius[i] = sphere.w;
+        }
+        std::vector<uint8_t> visible(padded);
+        const BoundsArrays bounds{ x.data(), y.data(), z.data(), radius.data() };
+        CullSpheresSimd(frustum, bounds, 0, count, visible.data());
+        for (uint32_t i = 0; i < count; i++) {
+            if (visible[i])
+                ids.push_back(candidates[i]);
+        }
+    }
+
+    void SceneBvh::QueryBox(const Aabb& box, std::vector<uint32_t>& ids)const
+    {
+        if (mRoot == NO_NODE)
+            return;
+        std::vector<uint32_t> stack{ mRoot };
+        while (!stack.empty()) {
+            const Node& node = mNodes[stack.back()];
+            stack.pop_back();
+            if (!Overlaps(node.bounds, box))
+                continue;
+            if (node.IsLeaf()) {
+                if (Overlaps(SphereBox(mSpheres[node.objectId]), box))
+                    ids.push_back(node.objectId);
+                continue;
+            }
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+
+    void SceneBvh::QueryRay(const Ray& ray, float maxDistance, std::vector<uint32_t>& ids)const
+    {
+        if (mRoot == NO_NODE)
+            return;
+        const glm::vec3 inverseDirection = 1.0f / ray.direction;
+        std::vector<uint32_t> stack{ mRoot };
+        while (!stack.empty()) {
+            const Node& node = mNodes[stack.back()];
+            stack.pop_back();
+            float tEnter;
+            if (!RayHitsBox(node.bounds, ray.origin, inverseDirection, maxDistance, tEnter))
+                continue;
+            if (node.IsLeaf()) {
+                if (RayHitsSphere(ray, mSpheres[node.objectId]) < maxDistance)
+                    ids.push_back(node.objectId);
+                continue;
+            }
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+
+    uint32_t SceneBvh::CastRay(const Ray& ray, float maxDistance, const RayHitTest& test, float& distance)const
+    {
+        uint32_t closest = NO_OBJECT;
+        distance = maxDistance;
+        if (mRoot == NO_NODE)
+            return closest;
+        const glm::vec3 inverseDirection = 1.0f / ray.direction;
+        //nodes with where the ray enters them, the nearest child is pushed last
+        std::vector<std::pair<uint32_t, float>> stack;
+        float tRoot;
+        if (RayHitsBox(mNodes[mRoot].bounds, ray.origin, inverseDirection, distance, tRoot))
+            stack.push_back({ mRoot, tRoot });
+        while (!stack.empty()) {
+            const auto [index, tEnter] = stack.back();
+            stack.pop_back();
+            //something closer was hit after the node was pushed
+            if (tEnter > distance)
+                continue;
+            const Node& node = mNodes[index];
+            if (node.IsLeaf()) {
+                const float sphereHit = RayHitsSphere(ray, mSpheres[node.objectId]);
+                if (sphereHit >= distance)
+                    continue;
+                const float hit = test ? test(node.objectId, distance) : sphereHit;
+                if (hit < distance) {
+                    distance = hit;
+                    closest = node.objectId;
+                }
+                continue;
+            }
+            float tChildren[2];
+            bool hits[2];
+            for (uint32_t c = 0; c < 2; c++) {
+                hits[c] = RayHitsBox(mNodes[node.children[c]].bounds, ray.origin, inverseDirection,
+                    distance, tChildren[c]);
+            }
+            const uint32_t nearest = (hits[0] && (!hits[1] || tChildren[0] <= tChildren[1])) ? 0 : 1;
+            const uint32_t farthest = 1 - nearest;
+            if (hits[farthest])
+                stack.push_back({ node.children[farthest], tChildren[farthest] });
+            if (hits[nearest])
+                stack.push_back({ node.children[nearest], tChildren[nearest] });
+        }
+        return closest;
+    }
+}
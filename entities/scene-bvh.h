@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "frustum-culling.h"
+#include "transform-store.h"
+namespace entities {
+    /// <summary>
+    /// What CastRay returns when the ray hits nothing.
+    /// </summary>
+    const uint32_t NO_OBJECT = UINT32_MAX;
+    /// <summary>
+    /// Axis aligned box, in world space.
+    /// </summary>
+    struct Aabb {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+    /// <summary>
+    /// Half line from origin along direction. Distances along the ray are in units of the
+    /// direction's length, normalize it to get them in world units.
+    /// </summary>
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+    /// <summary>
+    /// Narrow phase of CastRay: gets an object whose bounds the ray hits and the distance of the
+    /// closest hit so far, returns the distance of the ray's hit with the object or anything
+    /// >= maxDistance if it misses.
+    /// </summary>
+    using RayHitTest = std::function<float(uint32_t id, float maxDistance)>;
+    /// <summary>
+    /// Dynamic bounding volume hierarchy over the world bounds of game objects, to answer the
+    /// spatial questions (what is in the frustum, under the cursor, inside a box) without going
+    /// through every object. A binary tree with one object per leaf, the boxes of the leaves are
+    /// the objects' bounding spheres grown by a margin so that small motions don't touch the tree.
+    /// Insert and Remove change the tree in place, picking the sibling with the surface area
+    /// heuristic, and after enough of them Refit rebuilds the tree with a binned SAH build, see 
+    /// Build. Refit grows or moves the leaves whose object left its box and re-computes only the 
+    /// boxes above them, the shape of the tree stays. Call Build when the objects went far from
+    /// where they were at the last one.
+    /// Keeps its own copy of the spheres, the queries test the objects against those and not
+    /// against the grown boxes. Not thread-safe.
+    /// </summary>
+    class SceneBvh {
+    public:
+        /// <summary>
+        /// Adds the object with its world bounding sphere. The id must not be in the tree.
+        /// </summary>
+        void Insert(uint32_t id, const glm::vec3& center, float radius);
+        /// <summary>
+        /// Adds the objects with their spheres in bounds, indexed by id. None of the ids may be in 
+        /// the tree. When they are more than the tree has it's cheaper to build it all again than
+        /// to insert them one by one, and the result is better.
+        /// </summary>
+        void Insert(const std::vector<uint32_t>& ids, const BoundsArrays& bounds);
+        /// <summary>
+        /// Takes the object out of the tree, if it's there.
+        /// </summary>
+        void Remove(uint32_t id);
+        bool Contains(uint32_t id)const { return id < mLeafOfObject.size() && mLeafOfObject[id] != UINT32_MAX; }
+        /// <summary>
+        /// Number of objects in the tree.
+        /// </summary>
+        uint32_t Size()const { return mNumberOfObjects; }
+        /// <summary>
+        /// Throws the tree away and builds it again top-down from the objects it has, splitting
+        /// each node where the surface area heuristic says, over a few bins of the centroids.
+        /// </summary>
+        void Build();
+        /// <summary>
+        /// Takes the new spheres of the objects in the tree from bounds, indexed by id, and fixes
+        /// the boxes of the leaves that the spheres left and of their ancestors. Rebuilds the tree
+        /// when there were too many inserts and removes since the last Build. bounds must be
+        /// readable for every id in the tree. Returns how many leaves moved.
+        /// </summary>
+        uint32_t Refit(const BoundsArrays& bounds);
+        /// <summary>
+        /// Appends to ids the objects whose sphere touches the frustum. The tree throws away what
+        /// is outside and takes whole subtrees that are inside, the spheres of the leaves that 
+        /// cross a plane go through CullSpheresSimd.
+        /// </summary>
+        void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& ids)const;
+        /// <summary>
+        /// Appends to ids the objects whose sphere's box overlaps the box.
+        /// </summary>
+        void QueryBox(const Aabb& box, std::vector<uint32_t>& ids)const;
+        /// <summary>
+        /// Appends to ids the objects whose sphere the ray crosses before maxDistance, in no
+        /// particular order.
+        /// </summary>
+        void QueryRay(const Ray& ray, float maxDistance, std::vector<uint32_t>& ids)const;
+        /// <summary>
+        /// The closest object the ray hits before maxDistance, or NO_OBJECT. Visits the nodes
+        /// front to back and skips those farther than the closest hit so far. Without a test the
+        /// hit is where the ray enters the object's sphere, with one the test decides, see
+        /// RayHitTest. distance gets the hit's distance.
+        /// </summary>
+        uint32_t CastRay(const Ray& ray, float maxDistance, const RayHitTest& test, float& distance)const;
+    private:
+        struct Node {
+            Aabb bounds;
+            uint32_t parent = UINT32_MAX;
+            uint32_t children[2] = { UINT32_MAX, UINT32_MAX };
+            /// <summary>
+            /// The object of a leaf, UINT32_MAX for the inner nodes.
+            /// </summary>
+            uint32_t objectId = UINT32_MAX;
+            bool IsLeaf()const { return objectId != UINT32_MAX; }
+        };
+        uint32_t AllocateNode();
+        void FreeNode(uint32_t index);
+        /// <summary>
+        /// Hangs the leaf next to the node where it adds the least surface area.
+        /// </summary>
+        void InsertLeaf(uint32_t leaf);
+        /// <summary>
+        /// Unhooks the leaf from the tree, the leaf node itself stays allocated.
+        /// </summary>
+        void RemoveLeaf(uint32_t leaf);
+        /// <summary>
+        /// Re-computes the boxes from the node up to the root, stopping at the first that
+        /// doesn't change.
+        /// </summary>
+        void RefitAncestors(uint32_t node);
+        /// <summary>
+        /// Visits the leaves under the node that don't need any more tests.
+        /// </summary>
+        void CollectObjects(uint32_t node, std::vector<uint32_t>& ids, std::vector<uint32_t>& stack)const;
+        std::vector<Node> mNodes;
+        std::vector<uint32_t> mFreeNodes;
+        uint32_t mRoot = UINT32_MAX;
+        /// <summary>
+        /// Leaf of each object id, UINT32_MAX if the object isn't in the tree.
+        /// </summary>
+        std::vector<uint32_t> mLeafOfObject;
+        /// <summary>
+        /// World bounding sphere of each object id, center in xyz and radius in w.
+        /// </summary>
+        std::vector<glm::vec4> mSpheres;
+        uint32_t mNumberOfObjects = 0;
+        /// <summary>
+        /// Inserts and removes since the last Build.
+        /// </summary>
+        uint32_t mChangesSinceBuild = 0;
+    };
+}
@@ -0,0 +1,538 @@
+#include "transform-store.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <cstring>
+#include <cstddef>
+#include <glm/gtc/matrix_transform.hpp>
+#include "game-object.h"
+#include "utils/job-system.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_STORE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace entities {
+    static const uint8_t ALL_FRAMES_DIRTY = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+    /// <summary>
+    /// The arrays grow in multiples of this, so that the SIMD kernel can always read whole blocks of 4.
+    /// </summary>
+    static const uint32_t GROWTH_GRANULARITY = 1024;
+    /// <summary>
+    /// Objects per job of the parallel update, a multiple of 4 so that the ranges are whole SIMD blocks.
+    /// </summary>
+    static const uint32_t UPDATE_GRAIN_SIZE = 4096;
+
+    static inline void WriteObjectId(uintptr_t record, uint32_t id)
+    {
+        memcpy(reinterpret_cast<void*>(record + offsetof(ObjectUniformBuffer, objectId)), &id, sizeof(uint32_t));
+    }
+
+    uint32_t ComposeModelMatricesScalar(const TransformArrays& t, uint32_t first, uint32_t count,
+        const uint8_t* dirtyFrames, uint8_t dirtyBit, const uintptr_t* destinations,
+        const uint32_t* parents)
+    {
+        uint32_t written = 0;
+        for (uint32_t id = first; id < first + count; id++) {
+            if (dirtyFrames != nullptr && (dirtyFrames[id] & dirtyBit) == 0)
+                continue;
+            if (parents != nullptr && parents[id] != NO_PARENT)
+                continue;
+            const float x = t.qx[id], y = t.qy[id], z = t.qz[id], w = t.qw[id];
+            const float xx = x * x, yy = y * y, zz = z * z;
+            const float xy = x * y, xz = x * z, yz = y * z;
+            const float wx = w * x, wy = w * y, wz = w * z;
+            //same as glm::translate * glm::mat4_cast * glm::scale, column major
+            float m[16] = {
+                (1.0f - 2.0f * (yy + zz)) * t.sx[id], 2.0f * (xy + wz) * t.sx[id], 2.0f * (xz - wy) * t.sx[id], 0.0f,
+                2.0f * (xy - wz) * t.sy[id], (1.0f - 2.0f * (xx + zz)) * t.sy[id], 2.0f * (yz + wx) * t.sy[id], 0.0f,
+                2.0f * (xz + wy) * t.sz[id], 2.0f * (yz - wx) * t.sz[id], (1.0f - 2.0f * (xx + yy)) * t.sz[id], 0.0f,
+                t.px[id], t.py[id], t.pz[id], 1.0f
+            };
+            memcpy(reinterpret_cast<void*>(destinations[id]), m, sizeof(m));
+            WriteObjectId(destinations[id], id);
+            written++;
+        }
+        return written;
+    }
+
+#ifdef TRANSFORM_STORE_SSE
+    /// <summary>
+    /// Turns 4 vectors holding one matrix element for 4 objects each into one column per object
+    /// and stores them.
+    /// </summary>
+    static inline void StoreColumn(__m128 row0, __m128 row1, __m128 row2, __m128 row3,
+        const uintptr_t* records, uint32_t mask, size_t column)
+    {
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+        const __m128 columns[4] = { row0, row1, row2, row3 };
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            if (mask & (1u << lane))
+                _mm_storeu_ps(reinterpret_cast<float*>(records[lane] + column * 4 * sizeof(float)), columns[lane]);
+        }
+    }
+#endif
+
+    uint32_t ComposeModelMatricesSimd(const TransformArrays& t, uint32_t first, uint32_t count,
+        const uint8_t* dirtyFrames, uint8_t dirtyBit, const uintptr_t* destinations,
+        const uint32_t* parents)
+    {
+#ifdef TRANSFORM_STORE_SSE
+        uint32_t written = 0;
+        const uint32_t end = first + count;
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 zero = _mm_setzero_ps();
+        for (uint32_t block = first; block < end; block += 4) {
+            //which of the 4 lanes are in range and need to be written
+            uint32_t mask = 0;
+            for (uint32_t lane = 0; lane < 4 && block + lane < end; lane++) {
+                if (dirtyFrames != nullptr && (dirtyFrames[block + lane] & dirtyBit) == 0)
+                    continue;
+                if (parents != nullptr && parents[block + lane] != NO_PARENT)
+                    continue;
+                mask |= 1u << lane;
+            }
+            if (mask == 0)
+                continue;
+            const __m128 x = _mm_loadu_ps(t.qx + block), y = _mm_loadu_ps(t.qy + block);
+            const __m128 z = _mm_loadu_ps(t.qz + block), w = _mm_loadu_ps(t.qw + block);
+            const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+            const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+            const __m128 sx = _mm_loadu_ps(t.sx + block);
+            const __m128 sy = _mm_loadu_ps(t.sy + block);
+            const __m128 sz = _mm_loadu_ps(t.sz + block);
+            const uintptr_t* records = destinations + block;
+            //column 0
+            StoreColumn(
+                _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+                _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+                _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+                zero, records, mask, 0);
+            //column 1
+            StoreColumn(
+                _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+                _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+                _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+                zero, records, mask, 1);
+            //column 2
+            StoreColumn(
+                _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+                _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+                _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+                zero, records, mask, 2);
+            //column 3, the translation
+            StoreColumn(_mm_loadu_ps(t.px + block), _mm_loadu_ps(t.py + block), _mm_loadu_ps(t.pz + block),
+                one, records, mask, 3);
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                if (mask & (1u << lane)) {
+                    WriteObjectId(records[lane], block + lane);
+                    written++;
+                }
+            }
+        }
+        return written;
+#else
+        return ComposeModelMatricesScalar(t, first, count, dirtyFrames, dirtyBit, destinations, parents);
+#endif
+    }
+
+    TransformStore& TransformStore::Instance()
+    {
+        static TransformStore instance;
+        return instance;
+    }
+
+    void TransformStore::Grow(uint32_t id)
+    {
+        if (id < mDirtyFrames.size())
+            return;
+        const size_t newSize = (static_cast<size_t>(id) / GROWTH_GRANULARITY + 1) * GROWTH_GRANULARITY;
+        for (auto* v : { &mPx, &mPy, &mPz, &mQx, &mQy, &mQz })
+            v->resize(newSize, 0.0f);
+        for (auto* v : { &mQw, &mSx, &mSy, &mSz })
+            v->resize(newSize, 1.0f);
+        for (auto* v : { &mLocalCx, &mLocalCy, &mLocalCz, &mLocalRadius, &mBoundsX, &mBoundsY, &mBoundsZ, &mBoundsRadius })
+            v->resize(newSize, 0.0f);
+        mBoundsChanged.resize(newSize, 0);
+        mDirtyFrames.resize(newSize, 0);
+        for (auto& addresses : mRecordAddresses)
+            addresses.resize(newSize, 0);
+        mParents.resize(newSize, NO_PARENT);
+        mNumberOfChildren.resize(newSize, 0);
+        mLocalChanged.resize(newSize, 0);
+        mWorldChanged.resize(newSize, 0);
+        mWorldMatrices.resize(newSize, glm::mat4(1.0f));
+    }
+
+    template<typename F>
+    bool TransformStore::ChangePending(uint32_t id, F&& change)
+    {
+        if (IsFrameThread()) {
+            //the setters ApplyPendingChanges calls itself don't start another round, what's queued
+            //meanwhile comes after the current round
+            if (!mApplyingPendingChanges && mHasPendingChanges.load(std::memory_order_acquire))
+                ApplyPendingChanges();
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto pending = mPendingChangeOfId.find(id);
+        if (pending == mPendingChangeOfId.end()) {
+            PendingChange set;
+            set.id = id;
+            pending = mPendingChangeOfId.emplace(id, mPendingChanges.size()).first;
+            mPendingChanges.push_back(set);
+            mHasPendingChanges.store(true, std::memory_order_release);
+        }
+        change(mPendingChanges[pending->second]);
+        return true;
+    }
+
+    void TransformStore::Add(uint32_t id, const std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT>& recordAddresses)
+    {
+        if (IsFrameThread()) {
+            //the queued changes came first
+            if (mHasPendingChanges.load(std::memory_order_acquire))
+                ApplyPendingChanges();
+            AddNow(id, recordAddresses);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        PendingChange change;
+        change.id = id;
+        change.kind = PendingChange::ADD;
+        change.fields = PendingChange::ALL_FIELDS;
+        change.recordAddresses = recordAddresses;
+        mPendingChangeOfId[id] = mPendingChanges.size();
+        mPendingChanges.push_back(change);
+        mHasPendingChanges.store(true, std::memory_order_release);
+    }
+
+    void TransformStore::Remove(uint32_t id)
+    {
+        if (IsFrameThread()) {
+            if (mHasPendingChanges.load(std::memory_order_acquire))
+                ApplyPendingChanges();
+            RemoveNow(id);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        PendingChange change;
+        change.id = id;
+        change.kind = PendingChange::REMOVE;
+        mPendingChangeOfId.erase(id);
+        mPendingChanges.push_back(change);
+        mHasPendingChanges.store(true, std::memory_order_release);
+    }
+
+    void TransformStore::ApplyPendingChanges()
+    {
+        assert(IsFrameThread());
+        std::vector<PendingChange> changes;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            changes.swap(mPendingChanges);
+            mPendingChangeOfId.clear();
+            mHasPendingChanges.store(false, std::memory_order_relaxed);
+        }
+        mApplyingPendingChanges = true;
+        for (const PendingChange& change : changes) {
+            if (change.kind == PendingChange::REMOVE) {
+                RemoveNow(change.id);
+                continue;
+            }
+            if (change.kind == PendingChange::ADD)
+                AddNow(change.id, change.recordAddresses);
+            if (change.fields & PendingChange::POSITION)
+                SetPosition(change.id, change.position);
+            if (change.fields & PendingChange::ORIENTATION)
+                SetOrientation(change.id, change.orientation);
+            if (change.fields & PendingChange::SCALE)
+                SetScale(change.id, change.scale);
+            if (change.fields & PendingChange::LOCAL_BOUNDS)
+                SetLocalBounds(change.id, change.localCenter, change.localRadius);
+        }
+        mApplyingPendingChanges = false;
+    }
+
+    void TransformStore::AddNow(uint32_t id, const std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT>& recordAddresses)
+    {
+        Grow(id);
+        mPx[id] = mPy[id] = mPz[id] = 0.0f;
+        mQx[id] = mQy[id] = mQz[id] = 0.0f;
+        mQw[id] = 1.0f;
+        mSx[id] = mSy[id] = mSz[id] = 1.0f;
+        mLocalCx[id] = mLocalCy[id] = mLocalCz[id] = mLocalRadius[id] = 0.0f;
+        mBoundsChanged[id] = 1;
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+            mRecordAddresses[frame][id] = recordAddresses[frame];
+        //new objects have no record yet
+        mDirtyFrames[id] = ALL_FRAMES_DIRTY;
+        mParents[id] = NO_PARENT;
+        mNumberOfChildren[id] = 0;
+        mLocalChanged[id] = 0;
+    }
+
+    void TransformStore::RemoveNow(uint32_t id)
+    {
+        assert(id < mDirtyFrames.size());
+        mDirtyFrames[id] = 0;
+        if (!IsInHierarchy(id))
+            return;
+        //the children become roots, keeping their local transforms. mHierarchyOrder misses the
+        //children parented since the last sort, then it's all the ids.
+        if (mNumberOfChildren[id] > 0) {
+            uint32_t detached = 0;
+            auto detach = [&](uint32_t child) {
+                if (mParents[child] != id)
+                    return;
+                mParents[child] = NO_PARENT;
+                mLocalChanged[child] = 1;
+                mDirtyFrames[child] = ALL_FRAMES_DIRTY;
+                mBoundsChanged[child] = 1;
+                detached++;
+            };
+            if (mHierarchyOrderIsStale) {
+                for (uint32_t child = 0; child < Capacity() && detached < mNumberOfChildren[id]; child++)
+                    detach(child);
+            }
+            else {
+                for (uint32_t child : mHierarchyOrder)
+                    detach(child);
+            }
+            //a child left behind would be attached to whoever gets the id next
+            assert(detached == mNumberOfChildren[id]);
+            mNumberOfChildren[id] = 0;
+        }
+        if (mParents[id] != NO_PARENT) {
+            mNumberOfChildren[mParents[id]]--;
+            mParents[id] = NO_PARENT;
+        }
+        mHierarchyOrderIsStale = true;
+    }
+
+    void TransformStore::SetParent(uint32_t id, uint32_t parent)
+    {
+        if (!IsFrameThread())
+            throw std::runtime_error("SetParent must be called from the frame thread");
+        if (mHasPendingChanges.load(std::memory_order_acquire))
+            ApplyPendingChanges();
+        if (mParents[id] == parent)
+            return;
+        for (uint32_t ancestor = parent; ancestor != NO_PARENT; ancestor = mParents[ancestor]) {
+            if (ancestor == id)
+                throw std::runtime_error("object can't be a descendant of itself");
+        }
+        if (mParents[id] != NO_PARENT)
+            mNumberOfChildren[mParents[id]]--;
+        mParents[id] = parent;
+        if (parent != NO_PARENT)
+            mNumberOfChildren[parent]++;
+        mLocalChanged[id] = 1;
+        mDirtyFrames[id] = ALL_FRAMES_DIRTY;
+        mBoundsChanged[id] = 1;
+        mHierarchyOrderIsStale = true;
+    }
+
+    void TransformStore::SetLocalBounds(uint32_t id, const glm::vec3& center, float radius)
+    {
+        if (ChangePending(id, [&](PendingChange& pending) { pending.localCenter = center; pending.localRadius = radius;
+            pending.fields |= PendingChange::LOCAL_BOUNDS; }))
+            return;
+        mLocalCx[id] = center.x; mLocalCy[id] = center.y; mLocalCz[id] = center.z;
+        mLocalRadius[id] = radius;
+        mBoundsChanged[id] = 1;
+    }
+
+    void TransformStore::UpdateWorldBounds(uint32_t id)
+    {
+        const glm::vec3 center(mLocalCx[id], mLocalCy[id], mLocalCz[id]);
+        glm::vec3 worldCenter;
+        float maxScale;
+        if (IsInHierarchy(id)) {
+            const glm::mat4& world = mWorldMatrices[id];
+            worldCenter = glm::vec3(world * glm::vec4(center, 1.0f));
+            //the longest axis of the matrix is the largest scale
+            maxScale = std::sqrt(std::max({ glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+                glm::dot(glm::vec3(world[1]), glm::vec3(world[1])),
+                glm::dot(glm::vec3(world[2]), glm::vec3(world[2])) }));
+        }
+        else {
+            //translate * rotate * scale without building the matrix
+            const glm::vec3 scale = GetScale(id);
+            worldCenter = GetPosition(id) + GetOrientation(id) * (scale * center);
+            maxScale = std::max({ std::abs(scale.x), std::abs(scale.y), std::abs(scale.z) });
+        }
+        mBoundsX[id] = worldCenter.x; mBoundsY[id] = worldCenter.y; mBoundsZ[id] = worldCenter.z;
+        mBoundsRadius[id] = mLocalRadius[id] * maxScale;
+    }
+
+    glm::mat4 TransformStore::ComposeLocal(uint32_t id) const
+    {
+        return glm::translate(glm::mat4(1.0f), GetPosition(id)) * glm::mat4_cast(GetOrientation(id)) *
+            glm::scale(glm::mat4(1.0f), GetScale(id));
+    }
+
+    glm::mat4 TransformStore::GetWorldMatrix(uint32_t id) const
+    {
+        if (IsInHierarchy(id))
+            return mWorldMatrices[id];
+        return ComposeLocal(id);
+    }
+
+    glm::vec3 TransformStore::GetWorldPosition(uint32_t id) const
+    {
+        if (IsInHierarchy(id))
+            return glm::vec3(mWorldMatrices[id][3]);
+        return GetPosition(id);
+    }
+
+    void TransformStore::SortHierarchy()
+    {
+        mHierarchyOrder.clear();
+        std::vector<std::pair<uint32_t, uint32_t>> depthAndId;
+        for (uint32_t id = 0; id < Capacity(); id++) {
+            if (!IsInHierarchy(id))
+                continue;
+            uint32_t depth = 0;
+            for (uint32_t ancestor = mParents[id]; ancestor != NO_PARENT; ancestor = mParents[ancestor])
+                depth++;
+            depthAndId.emplace_back(depth, id);
+        }
+        //parents always come before their children, and siblings stay next to each other 
+        std::sort(depthAndId.begin(), depthAndId.end());
+        for (const auto& entry : depthAndId) {
+            mHierarchyOrder.push_back(entry.second);
+            //the new order may have new members, they get their world matrix in the next sweep
+            mLocalChanged[entry.second] = 1;
+        }
+        mHierarchyOrderIsStale = false;
+    }
+
+    void TransformStore::PropagateHierarchy()
+    {
+        mLastPropagationCount = 0;
+        if (mHierarchyOrderIsStale)
+            SortHierarchy();
+        for (uint32_t id : mHierarchyOrder) {
+            const uint32_t parent = mParents[id];
+            const bool parentChanged = parent != NO_PARENT && mWorldChanged[parent];
+            if (mLocalChanged[id] || parentChanged) {
+                mWorldMatrices[id] = parent != NO_PARENT ? 
+                    mWorldMatrices[parent] * ComposeLocal(id) : ComposeLocal(id);
+                mWorldChanged[id] = 1;
+                mDirtyFrames[id] = ALL_FRAMES_DIRTY;
+                mBoundsChanged[id] = 1;
+                mLastPropagationCount++;
+            }
+            mLocalChanged[id] = 0;
+        }
+        for (uint32_t id : mHierarchyOrder)
+            mWorldChanged[id] = 0;
+    }
+
+    void TransformStore::SetPosition(uint32_t id, const glm::vec3& pos)
+    {
+        if (ChangePending(id, [&](PendingChange& pending) { pending.position = pos; pending.fields |= PendingChange::POSITION; }))
+            return;
+        mPx[id] = pos.x; mPy[id] = pos.y; mPz[id] = pos.z;
+        mDirtyFrames[id] = ALL_FRAMES_DIRTY;
+        mLocalChanged[id] = 1;
+        mBoundsChanged[id] = 1;
+    }
+
+    glm::vec3 TransformStore::GetPosition(uint32_t id) const
+    {
+        return glm::vec3(mPx[id], mPy[id], mPz[id]);
+    }
+
+    void TransformStore::SetOrientation(uint32_t id, const glm::quat& o)
+    {
+        if (ChangePending(id, [&](PendingChange& pending) { pending.orientation = o; pending.fields |= PendingChange::ORIENTATION; }))
+            return;
+        mQx[id] = o.x; mQy[id] = o.y; mQz[id] = o.z; mQw[id] = o.w;
+        mDirtyFrames[id] = ALL_FRAMES_DIRTY;
+        mLocalChanged[id] = 1;
+        mBoundsChanged[id] = 1;
+    }
+
+    glm::quat TransformStore::GetOrientation(uint32_t id) const
+    {
+        return glm::quat(mQw[id], mQx[id], mQy[id], mQz[id]);
+    }
+
+    void TransformStore::SetScale(uint32_t id, const glm::vec3& scale)
+    {
+        if (ChangePending(id, [&](PendingChange& pending) { pending.scale = scale; pending.fields |= PendingChange::SCALE; }))
+            return;
+        mSx[id] = scale.x; mSy[id] = scale.y; mSz[id] = scale.z;
+        mDirtyFrames[id] = ALL_FRAMES_DIRTY;
+        mLocalChanged[id] = 1;
+        mBoundsChanged[id] = 1;
+    }
+
+    glm::vec3 TransformStore::GetScale(uint32_t id) const
+    {
+        return glm::vec3(mSx[id], mSy[id], mSz[id]);
+    }
+
+    TransformArrays TransformStore::GetArrays() const
+    {
+        return TransformArrays{ mPx.data(), mPy.data(), mPz.data(),
+            mQx.data(), mQy.data(), mQz.data(), mQw.data(),
+            mSx.data(), mSy.data(), mSz.data() };
+    }
+
+    BoundsArrays TransformStore::GetWorldBounds() const
+    {
+        return BoundsArrays{ mBoundsX.data(), mBoundsY.data(), mBoundsZ.data(), mBoundsRadius.data() };
+    }
+
+    uint32_t TransformStore::Update(uint32_t frame)
+    {
+        mFrameThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        if (mHasPendingChanges.load(std::memory_order_acquire))
+            ApplyPendingChanges();
+        const uint8_t dirtyBit = static_cast<uint8_t>(1u << frame);
+        PropagateHierarchy();
+        //objects without parent, the local matrix is the model matrix. Each range writes its own
+        //records and clears its own dirty bits, so the ranges can run in parallel.
+        const TransformArrays arrays = GetArrays();
+        std::atomic<uint32_t> rootsWritten{ 0 };
+        auto updateRange = [&](uint32_t begin, uint32_t end) {
+            uint32_t n = ComposeModelMatricesSimd(arrays, begin, end - begin,
+                mDirtyFrames.data(), dirtyBit, mRecordAddresses[frame].data(), mParents.data());
+            //objects with parent keep the bit, their records are written below
+            for (uint32_t id = begin; id < end; id++) {
+                if (mParents[id] == NO_PARENT)
+                    mDirtyFrames[id] &= ~dirtyBit;
+                //the sweep already ran, the world matrices of the hierarchies are up to date
+                if (mBoundsChanged[id]) {
+                    UpdateWorldBounds(id);
+                    mBoundsChanged[id] = 0;
+                }
+            }
+            rootsWritten.fetch_add(n, std::memory_order_relaxed);
+        };
+        if (utils::JobSystem::gJobSystem != nullptr)
+            utils::JobSystem::gJobSystem->ParallelFor(Capacity(), UPDATE_GRAIN_SIZE, updateRange);
+        else
+            updateRange(0, Capacity());
+        uint32_t written = rootsWritten.load();
+        //objects with parent get the world matrix the sweep computed
+        for (uint32_t id : mHierarchyOrder) {
+            if (mParents[id] == NO_PARENT || (mDirtyFrames[id] & dirtyBit) == 0)
+                continue;
+            const uintptr_t record = mRecordAddresses[frame][id];
+            memcpy(reinterpret_cast<void*>(record + offsetof(ObjectUniformBuffer, model)), 
+                &mWorldMatrices[id], sizeof(glm::mat4));
+            WriteObjectId(record, id);
+            mDirtyFrames[id] &= ~dirtyBit;
+            written++;
+        }
+        return written;
+    }
+}
@@ -0,0 +1,234 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+namespace entities {
+    /// <summary>
+    /// Read-only view of the transform arrays, indexed by game object id.
+    /// </summary>
+    struct TransformArrays {
+        const float* px; const float* py; const float* pz;
+        const float* qx; const float* qy; const float* qz; const float* qw;
+        const float* sx; const float* sy; const float* sz;
+    };
+    /// <summary>
+    /// Read-only view of the world space bounding spheres, indexed by game object id.
+    /// </summary>
+    struct BoundsArrays {
+        const float* x; const float* y; const float* z;
+        const float* radius;
+    };
+    /// <summary>
+    /// Parent of objects that are not in a hierarchy.
+    /// </summary>
+    const uint32_t NO_PARENT = UINT32_MAX;
+    /// <summary>
+    /// Composes translate * rotate * scale for objects [first, first + count) and writes each 
+    /// model matrix, column major, plus the object id into the ObjectUniformBuffer record at 
+    /// destinations[id]. If dirtyFrames isn't null only objects with dirtyBit set are written. If
+    /// parents isn't null objects that have a parent are skipped, their model matrix isn't the local one.
+    /// Returns how many records were written.
+    /// This one does one object at a time, it's the reference for the SIMD version.
+    /// </summary>
+    uint32_t ComposeModelMatricesScalar(const TransformArrays& transforms, uint32_t first, uint32_t count,
+        const uint8_t* dirtyFrames, uint8_t dirtyBit, const uintptr_t* destinations, 
+        const uint32_t* parents = nullptr);
+    /// <summary>
+    /// Same as ComposeModelMatricesScalar but 4 objects at a time with SSE. The arrays must be
+    /// readable up to first + count rounded up to 4. Falls back to the scalar version when SSE 
+    /// isn't available.
+    /// </summary>
+    uint32_t ComposeModelMatricesSimd(const TransformArrays& transforms, uint32_t first, uint32_t count,
+        const uint8_t* dirtyFrames, uint8_t dirtyBit, const uintptr_t* destinations,
+        const uint32_t* parents = nullptr);
+    /// <summary>
+    /// Position, orientation and scale of every game object, as a structure of arrays indexed by
+    /// the object id. Keeping the components in contiguous arrays lets the transform update phase 
+    /// compose the model matrices of several objects at once with SIMD and stream them to the
+    /// object uniform pool.
+    /// Each object has one dirty bit per frame in flight, set by the setters and cleared when the
+    /// frame's record is written.
+    /// Each object also has a bounding sphere in its own space, and Update keeps the world space 
+    /// sphere in another set of arrays, re-computed only for the objects that moved.
+    /// Objects can have a parent, then position/orientation/scale are relative to it. Objects in
+    /// hierarchies are kept in a flat array sorted by depth, parents before children, and Update
+    /// sweeps it once re-computing only the world matrices under nodes that changed. Objects 
+    /// without parent or children, most of them, never touch that path.
+    /// The arrays are only touched by the frame thread: the thread that called Update last, or the
+    /// one that created the store before the first Update. Add, Remove, the setters and 
+    /// SetLocalBounds may be called from loader threads, then they are queued and the frame thread
+    /// applies them in call order at the start of Update, or in ApplyPendingChanges. SetParent,
+    /// the getters and Update must happen on the frame thread, the getters only see the queued 
+    /// changes once they are applied. The views from GetArrays and GetWorldBounds are valid until
+    /// the frame thread applies an Add.
+    /// </summary>
+    class TransformStore {
+    public:
+        static TransformStore& Instance();
+        TransformStore(const TransformStore&) = delete;
+        TransformStore& operator=(const TransformStore&) = delete;
+        /// <summary>
+        /// Starts tracking the id with an identity transform. recordAddresses are the mapped 
+        /// addresses of the object's ObjectUniformBuffer record for each frame in flight.
+        /// Queued if called outside of the frame thread.
+        /// </summary>
+        void Add(uint32_t id, const std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT>& recordAddresses);
+        /// <summary>
+        /// Stops tracking the id. Queued if called outside of the frame thread.
+        /// </summary>
+        void Remove(uint32_t id);
+        /// <summary>
+        /// Frame thread only. Applies the changes queued by other threads, so that the objects
+        /// they made can be used from the frame thread before the next Update.
+        /// </summary>
+        void ApplyPendingChanges();
+        void SetPosition(uint32_t id, const glm::vec3& pos);
+        glm::vec3 GetPosition(uint32_t id)const;
+        void SetOrientation(uint32_t id, const glm::quat& o);
+        glm::quat GetOrientation(uint32_t id)const;
+        void SetScale(uint32_t id, const glm::vec3& scale);
+        glm::vec3 GetScale(uint32_t id)const;
+        /// <summary>
+        /// Makes parent the parent of id, or detaches id if parent is NO_PARENT. The local transform
+        /// is kept, so the object moves with its new parent. Throws if it would make a cycle.
+        /// </summary>
+        void SetParent(uint32_t id, uint32_t parent);
+        /// <summary>
+        /// The object's bounding sphere in its own space, usually its mesh's. Objects start with 
+        /// a sphere of radius 0 at their origin.
+        /// </summary>
+        void SetLocalBounds(uint32_t id, const glm::vec3& center, float radius);
+        uint32_t GetParent(uint32_t id)const { return mParents[id]; }
+        /// <summary>
+        /// The model matrix, including the parents. For objects in hierarchies it's the one 
+        /// computed by the last Update.
+        /// </summary>
+        glm::mat4 GetWorldMatrix(uint32_t id)const;
+        /// <summary>
+        /// The translation of the world matrix, without composing the matrix for objects that 
+        /// aren't in hierarchies.
+        /// </summary>
+        glm::vec3 GetWorldPosition(uint32_t id)const;
+        bool IsDirty(uint32_t id, uint32_t frame)const {
+            return (mDirtyFrames[id] & (1u << frame)) != 0;
+        }
+        /// <summary>
+        /// The transform update phase: writes the records of every object that is dirty for the 
+        /// frame and the world bounds of every object that moved. Returns how many records were written.
+        /// The objects without parent are split in ranges over utils::JobSystem::gJobSystem, when
+        /// there is one. The hierarchy sweep runs on the calling thread.
+        /// </summary>
+        uint32_t Update(uint32_t frame);
+        /// <summary>
+        /// Number of world matrices the last Update re-computed in hierarchies.
+        /// </summary>
+        uint32_t GetLastPropagationCount()const { return mLastPropagationCount; }
+        /// <summary>
+        /// Number of ids the arrays have room for, alive or not.
+        /// </summary>
+        uint32_t Capacity()const { return static_cast<uint32_t>(mDirtyFrames.size()); }
+        TransformArrays GetArrays()const;
+        /// <summary>
+        /// The world space bounding spheres as of the last Update. Readable up to Capacity(), 
+        /// that is a multiple of 4.
+        /// </summary>
+        BoundsArrays GetWorldBounds()const;
+    private:
+        TransformStore() = default;
+        ~TransformStore() = default;
+        /// <summary>
+        /// An Add, a Remove or setter calls from another thread, waiting for the frame thread.
+        /// fields says what the setters changed, an Add changes everything.
+        /// </summary>
+        struct PendingChange {
+            enum Kind : uint8_t { ADD, REMOVE, SET };
+            enum Fields : uint8_t { POSITION = 1, ORIENTATION = 2, SCALE = 4, LOCAL_BOUNDS = 8, ALL_FIELDS = 15 };
+            uint32_t id = 0;
+            Kind kind = SET;
+            uint8_t fields = 0;
+            std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT> recordAddresses{};
+            glm::vec3 position = glm::vec3(0.0f);
+            glm::quat orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+            glm::vec3 scale = glm::vec3(1.0f);
+            glm::vec3 localCenter = glm::vec3(0.0f);
+            float localRadius = 0.0f;
+        };
+        bool IsFrameThread()const { return std::this_thread::get_id() == mFrameThread.load(std::memory_order_relaxed); }
+        /// <summary>
+        /// Outside of the frame thread: calls change on the id's queued Add or setters, queueing
+        /// a new entry if there's none since the id's last Remove, and returns true. On the frame
+        /// thread: applies the queued changes, if any, and returns false, the caller changes the arrays.
+        /// </summary>
+        template<typename F>
+        bool ChangePending(uint32_t id, F&& change);
+        void AddNow(uint32_t id, const std::array<uintptr_t, MAX_FRAMES_IN_FLIGHT>& recordAddresses);
+        void RemoveNow(uint32_t id);
+        void Grow(uint32_t id);
+        glm::mat4 ComposeLocal(uint32_t id)const;
+        bool IsInHierarchy(uint32_t id)const { return mParents[id] != NO_PARENT || mNumberOfChildren[id] > 0; }
+        /// <summary>
+        /// Rebuilds mHierarchyOrder after parents changed.
+        /// </summary>
+        void SortHierarchy();
+        /// <summary>
+        /// Re-computes the world matrices under changed nodes and marks those objects dirty.
+        /// </summary>
+        void PropagateHierarchy();
+        /// <summary>
+        /// Moves the local bounding sphere to world space with the object's world transform.
+        /// </summary>
+        void UpdateWorldBounds(uint32_t id);
+        std::atomic<std::thread::id> mFrameThread{ std::this_thread::get_id() };
+        /// <summary>
+        /// The queue of the other threads' calls, in call order, and the last queued entry of
+        /// each id that wasn't removed since. Behind mMutex.
+        /// </summary>
+        std::mutex mMutex;
+        std::vector<PendingChange> mPendingChanges;
+        std::unordered_map<uint32_t, size_t> mPendingChangeOfId;
+        std::atomic<bool> mHasPendingChanges{ false };
+        bool mApplyingPendingChanges = false;
+        std::vector<float> mPx, mPy, mPz;
+        std::vector<float> mQx, mQy, mQz, mQw;
+        std::vector<float> mSx, mSy, mSz;
+        std::vector<float> mLocalCx, mLocalCy, mLocalCz, mLocalRadius;
+        std::vector<float> mBoundsX, mBoundsY, mBoundsZ, mBoundsRadius;
+        /// <summary>
+        /// Set when the world bounds are out of date, by the setters and by the hierarchy sweep.
+        /// </summary>
+        std::vector<uint8_t> mBoundsChanged;
+        /// <summary>
+        /// One bit per frame in flight, set when the frame's record is out of date. Removed ids 
+        /// have no bits set so they are never written.
+        /// </summary>
+        std::vector<uint8_t> mDirtyFrames;
+        std::array<std::vector<uintptr_t>, MAX_FRAMES_IN_FLIGHT> mRecordAddresses;
+        std::vector<uint32_t> mParents;
+        std::vector<uint32_t> mNumberOfChildren;
+        /// <summary>
+        /// Set by the setters, tells the hierarchy sweep that the local transform changed.
+        /// </summary>
+        std::vector<uint8_t> mLocalChanged;
+        /// <summary>
+        /// World matrices of the objects in hierarchies, the others don't use it.
+        /// </summary>
+        std::vector<glm::mat4> mWorldMatrices;
+        /// <summary>
+        /// Ids of the objects in hierarchies, sorted by depth.
+        /// </summary>
+        std::vector<uint32_t> mHierarchyOrder;
+        /// <summary>
+        /// Set during the sweep for the objects that got a new world matrix, so that their children
+        /// know they have to be re-computed too.
+        /// </summary>
+        std::vector<uint8_t> mWorldChanged;
+        bool mHierarchyOrderIsStale = false;
+        uint32_t mLastPropagationCount = 0;
+    };
+}
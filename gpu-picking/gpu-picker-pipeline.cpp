@@ -2,14 +2,15 @@
 #include "entities/pipeline.h"
 #include "vk/my-vk.h"
 #include <stdexcept>
+#include <algorithm>
 #include <utils/concatenate.h>
 #include <utils/object_namer.h>
 #include "entities/renderable.h"
 #include "entities/mesh.h"
-#include "vk\my-device.h"
-static VkBuffer buffer = VK_NULL_HANDLE;
-static VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
-VkDeviceSize bufferSize;
+#include "entities/instance-batcher.h"
+#include "vk/my-device.h"
+#include "utils/frame-stats.h"
+#include "vk/my-gpu-profiler.h"
 namespace GpuPicker {
     GpuPickerPipeline::GpuPickerPipeline(VkContext* ctx, 
         VkRenderPass renderPass, 
@@ -38,13 +39,18 @@ namespace GpuPicker {
         dynamicState.pDynamicStates = dynamicStates.data();
         //vertex input description - the same of hello pipeline bc we are rendering
         //meshes like it
-        auto bindingDescription = GetBindingDescription();
-        auto attributeDescriptions = GetAttributeDescriptions();
+        //binding 0 is the mesh, binding 1 the object id of each instance
+        std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {
+            GetBindingDescription(), GetInstanceBindingDescription() };
+        auto meshAttributeDescriptions = GetAttributeDescriptions();
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(
+            meshAttributeDescriptions.begin(), meshAttributeDescriptions.end());
+        attributeDescriptions.push_back(GetInstanceAttributeDescription());
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
         vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
         vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
         //input description: the geometry input will be triangles
         VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
@@ -82,21 +88,15 @@ namespace GpuPicker {
         colorBlending.logicOpEnable = VK_FALSE; //TODO: no color blending for now
         colorBlending.attachmentCount = 1;
         colorBlending.pAttachments = &colorBlendAttachment;
-        
-        // The push constant
-        VkPushConstantRange pushConstantRange = {};
-        pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;  // Specify the shader stage(s)
-        pushConstantRange.offset = 0;                               // Offset within the push constant block
-        pushConstantRange.size = sizeof(int); //The id is just an int
-        
+
         //pipeline layout, to pass data to the shaders, sends nothing for now
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
         pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-        //we use no push constants for now
-        pipelineLayoutInfo.pushConstantRangeCount = 1; // Optional
-        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange; // Optional
+        //no push constants, the object id comes with the instance
+        pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
+        pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
         if (vkCreatePipelineLayout(myvk::Device::gDevice->GetDevice(), &pipelineLayoutInfo,
             nullptr, &pipelineLayout) != VK_SUCCESS) {
             throw std::runtime_error("failed to create pipeline layout!");
@@ -145,6 +145,15 @@ namespace GpuPicker {
         //the shader modules are no longer necessary by now.
         vkDestroyShaderModule(myvk::Device::gDevice->GetDevice(), vertexShaderModule, nullptr);
         vkDestroyShaderModule(myvk::Device::gDevice->GetDevice(), fragmentShaderModule, nullptr);
+        //the readback buffers stay mapped, the cpu reads the region when the frame's slot comes around again
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+            const VkDeviceSize size = MAX_READBACK_SIZE * MAX_READBACK_SIZE * 4;
+            CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                mReadback[frame].buffer, mReadback[frame].memory, myvk::Device::gDevice->GetDevice());
+            SET_NAME(mReadback[frame].buffer, VK_OBJECT_TYPE_BUFFER, Concatenate(name, "Readback", frame).c_str());
+            vkMapMemory(myvk::Device::gDevice->GetDevice(), mReadback[frame].memory, 0, size, 0, &mReadback[frame].address);
+        }
     }
 
     GpuPickerPipeline::~GpuPickerPipeline()
@@ -154,27 +163,20 @@ namespace GpuPicker {
         //    vkDestroyDescriptorSetLayout(myvk::Device::gDevice->GetDevice(), dsl, nullptr);
         //}
         vkDestroyPipelineLayout(myvk::Device::gDevice->GetDevice(), pipelineLayout, nullptr);
-        vkFreeMemory(myvk::Device::gDevice->GetDevice(), bufferMemory, nullptr);
-        vkDestroyBuffer(myvk::Device::gDevice->GetDevice(), buffer, nullptr);
+        for (auto& readback : mReadback) {
+            vkUnmapMemory(myvk::Device::gDevice->GetDevice(), readback.memory);
+            vkFreeMemory(myvk::Device::gDevice->GetDevice(), readback.memory, nullptr);
+            vkDestroyBuffer(myvk::Device::gDevice->GetDevice(), readback.buffer, nullptr);
+        }
     }
 
     void GpuPickerPipeline::Bind(VkCommandBuffer cmd)
     {
         vkCmdBindPipeline(cmd,
             VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    }
-
-    void GpuPickerPipeline::DrawRenderable(entities::Renderable* go, CameraUniformBuffer* camera, VkCommandBuffer cmdBuffer)
-    {
-        SetMark({ 1.0f, 0.8f, 1.0f, 1.0f }, go->mName, cmdBuffer, *mCtx);
-        //copies camera data to gpu
-        memcpy(mCtx->helloCameraUniformBufferAddress[mCtx->currentFrame], camera, sizeof(CameraUniformBuffer));
-        //copies object data to gpu
-        go->CommitDataToObjectBuffer(mCtx->currentFrame);
-        go->mMesh->Bind(cmdBuffer);
-        //bind the camera descriptor set
+        //bind the camera descriptor set, once for the whole pass
         vkCmdBindDescriptorSets(
-            cmdBuffer,
+            cmd,
             VK_PIPELINE_BIND_POINT_GRAPHICS,   // We assume it's a graphics pipeline
             pipelineLayout,                    // The pipeline layout that matches the shader's descriptor set layouts
             0,                                 // firstSet, which is the index of the first descriptor set (set = 0)
@@ -183,47 +185,126 @@ namespace GpuPicker {
             0,                                 // dynamicOffsetCount, assuming no dynamic offsets
             nullptr                            // pDynamicOffsets, assuming no dynamic offsets
         );
-        //bind the object-specific descriptor set
-        // Bind the object-specific descriptor set (set = 1)
-        VkDescriptorSet objectDescriptorSet = go->GetDescriptorSet(mCtx->currentFrame);
-        uint32_t dynamicOffset = go->DynamicOffset(mCtx->currentFrame);
+        gFrameStats.pipelineBinds.fetch_add(1, std::memory_order_relaxed);
+        gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void GpuPickerPipeline::DrawBatch(const entities::InstanceBatch& batch, VkCommandBuffer cmdBuffer, entities::BoundDrawState& bound)
+    {
+        SetMark({ 1.0f, 0.8f, 1.0f, 1.0f }, batch.mesh->mName, cmdBuffer, *mCtx);
+        uint32_t drawScope = myvk::GpuProfiler::BeginDrawScope(cmdBuffer, batch.mesh->mName);
+        //the objects' records were written by the transform update phase, see UpdateTransforms
+        // Bind the page's descriptor set (set = 1), the instances pick their records in it. The 
+        // frame's offset is the same for every page, only the set can change.
+        if (bound.objectDescriptorSet != batch.objectDescriptorSet) {
+            uint32_t dynamicOffset = entities::GameObjectUniformBufferPool::FrameOffset(mCtx->currentFrame);
+            vkCmdBindDescriptorSets(
+                cmdBuffer,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipelineLayout,
+                1,                                 // firstSet, index of the first descriptor set (set = 1)
+                1,                                 // descriptorSetCount, number of descriptor sets to bind
+                &batch.objectDescriptorSet,        // Pointer to the array of descriptor sets (only one in this case)
+                1,
+                &dynamicOffset
+            );
+            bound.objectDescriptorSet = batch.objectDescriptorSet;
+            gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+        }
+        //Draw command, the vertex shader passes each instance's id to the fragment shader
+        vkCmdDrawIndexed(cmdBuffer,
+            static_cast<uint32_t>(batch.mesh->NumberOfIndices()),
+            batch.instanceCount,
+            batch.mesh->FirstIndex(),
+            batch.mesh->VertexOffset(),
+            batch.firstInstance);
+        gFrameStats.drawCalls.fetch_add(1, std::memory_order_relaxed);
+        myvk::GpuProfiler::EndDrawScope(cmdBuffer, drawScope);
+        EndMark(cmdBuffer);
+    }
+
+    void GpuPickerPipeline::DrawIndirect(const entities::IndirectDrawRange& range, VkBuffer indirectBuffer, VkCommandBuffer cmdBuffer)
+    {
+        // Bind the page's descriptor set (set = 1), every command of the range reads its records in it
+        uint32_t dynamicOffset = entities::GameObjectUniformBufferPool::FrameOffset(mCtx->currentFrame);
         vkCmdBindDescriptorSets(
             cmdBuffer,
             VK_PIPELINE_BIND_POINT_GRAPHICS,
             pipelineLayout,
-            1,                                 // firstSet, index of the first descriptor set (set = 1)
-            1,                                 // descriptorSetCount, number of descriptor sets to bind
-            &objectDescriptorSet,              // Pointer to the array of descriptor sets (only one in this case)
+            1,
+            1,
+            &range.objectDescriptorSet,
             1,
             &dynamicOffset
         );
-        //push the id to the shader using the push constant.
-        int id = go->mId;
-        vkCmdPushConstants(
-            cmdBuffer,                   // Command buffer
-            pipelineLayout,                  // Pipeline layout
-            VK_SHADER_STAGE_FRAGMENT_BIT,      // Shader stage(s)
-            0,                               // Offset within the push constant block
-            sizeof(int),                     // Size of the push constant data
-            &id // Pointer to the data
-        );
-        //Draw command
-        vkCmdDrawIndexed(cmdBuffer,
-            static_cast<uint32_t>(go->mMesh->NumberOfIndices()),
-            1,
-            0,
-            0,
-            0);
-        static PFN_vkCmdDebugMarkerEndEXT __vkCmdDebugMarkerEndEXT;
-        if (__vkCmdDebugMarkerEndEXT == VK_NULL_HANDLE) {
-            __vkCmdDebugMarkerEndEXT = (PFN_vkCmdDebugMarkerEndEXT)vkGetDeviceProcAddr(myvk::Device::gDevice->GetDevice(), "vkCmdDebugMarkerEndEXT");
+        gFrameStats.descriptorSetBinds.fetch_add(1, std::memory_order_relaxed);
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        const VkDeviceSize offset = static_cast<VkDeviceSize>(range.firstCommand) * stride;
+        if (myvk::Device::gDevice->GetEnabledFeatures().multiDrawIndirect) {
+            vkCmdDrawIndexedIndirect(cmdBuffer, indirectBuffer, offset, range.commandCount, stride);
+            gFrameStats.drawCalls.fetch_add(1, std::memory_order_relaxed);
         }
-        __vkCmdDebugMarkerEndEXT(cmdBuffer);
+        else {
+            //without multiDrawIndirect the draw count can only be 1
+            for (uint32_t i = 0; i < range.commandCount; i++) {
+                vkCmdDrawIndexedIndirect(cmdBuffer, indirectBuffer, offset + i * stride, 1, stride);
+            }
+            gFrameStats.drawCalls.fetch_add(range.commandCount, std::memory_order_relaxed);
+        }
+    }
+
+    uint32_t PickerRegion::IdAt(uint32_t column, uint32_t row)const
+    {
+        //the id became an rgb using the formula in idToColor at gpu_picker.frag
+        const uint8_t* pixel = pixels + (row * width + column) * 4;
+        return (pixel[0] << 16) + (pixel[1] << 8) + pixel[2];
+    }
+
+    uint32_t PickerRegion::ClosestId()const
+    {
+        if (pixels == nullptr)
+            return BACKGROUND_ID;
+        uint32_t closestId = BACKGROUND_ID;
+        uint32_t closestDistance2 = UINT32_MAX;
+        for (uint32_t row = 0; row < height; row++) {
+            for (uint32_t column = 0; column < width; column++) {
+                const int32_t dx = static_cast<int32_t>(column) - static_cast<int32_t>(cursorX);
+                const int32_t dy = static_cast<int32_t>(row) - static_cast<int32_t>(cursorY);
+                const uint32_t distance2 = static_cast<uint32_t>(dx * dx + dy * dy);
+                if (distance2 >= closestDistance2)
+                    continue;
+                const uint32_t id = IdAt(column, row);
+                if (id != BACKGROUND_ID) {
+                    closestId = id;
+                    closestDistance2 = distance2;
+                }
+            }
+        }
+        return closestId;
+    }
+
+    void GpuPickerPipeline::SetReadbackSize(uint32_t size)
+    {
+        mReadbackSize = std::min(std::max(size, 1u), MAX_READBACK_SIZE);
     }
 
     void GpuPickerPipeline::ScheduleTransferImageFromGPUtoCPU(VkCommandBuffer cmd,
-        VkImage gpuImage, uint32_t w, uint32_t h)
+        VkImage gpuImage, uint32_t w, uint32_t h, int32_t cursorX, int32_t cursorY, uint32_t frame)
     {
+        ClearRegion(frame);
+        PickerRegion& region = mReadback[frame].region;
+        if (cursorX < 0 || cursorY < 0 || cursorX >= static_cast<int32_t>(w) || cursorY >= static_cast<int32_t>(h))
+            return;
+        //the square centered on the cursor, pushed back inside the image at the borders
+        region.width = std::min(mReadbackSize, w);
+        region.height = std::min(mReadbackSize, h);
+        region.x = static_cast<uint32_t>(std::min(std::max(cursorX - static_cast<int32_t>(region.width / 2), 0),
+            static_cast<int32_t>(w - region.width)));
+        region.y = static_cast<uint32_t>(std::min(std::max(cursorY - static_cast<int32_t>(region.height / 2), 0),
+            static_cast<int32_t>(h - region.height)));
+        region.cursorX = cursorX - region.x;
+        region.cursorY = cursorY - region.y;
+        region.pixels = static_cast<const uint8_t*>(mReadback[frame].address);
         //memory barrier to wait for the image to be ready and once
         //ready transition it from it's original layout to the transfer
         //source layout
@@ -252,79 +333,47 @@ namespace GpuPicker {
             0, nullptr,                      // No buffer memory barriers
             1, &barrier                      // Image memory barrier
         );
-        //create the buffer and it's memory
-        bufferSize = w * h * 4;  // Size of the buffer in bytes
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = bufferSize;  // Size of the buffer
-        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;  // Buffer will be used as a transfer destination
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;  // Only one queue will use this buffer
-
-        if (buffer == VK_NULL_HANDLE) {
-            if (vkCreateBuffer(myvk::Device::gDevice->GetDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to create buffer!");
-            }
-            SET_NAME(buffer, VK_OBJECT_TYPE_BUFFER, "gpuPickerBuffer");
-        }
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(myvk::Device::gDevice->GetDevice(), buffer, &memRequirements);
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, *mCtx);
-        if (bufferMemory == VK_NULL_HANDLE) {
-            if (vkAllocateMemory(myvk::Device::gDevice->GetDevice(), &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to allocate buffer memory!");
-            }
-            SET_NAME(bufferMemory, VK_OBJECT_TYPE_DEVICE_MEMORY, "gpuPickerBufferMemory");
-            vkBindBufferMemory(myvk::Device::gDevice->GetDevice(), buffer, bufferMemory, 0);
-        }
-
-        //copy the content from the image to the buffer
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;  // Start at the beginning of the buffer
-        region.bufferRowLength = 0;  // Tightly packed (0 means the buffer has no padding)
-        region.bufferImageHeight = 0;  // Tightly packed (0 means no padding)
-        // Specify the subresource layers of the image
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;  // Assuming this is a color image
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        // Specify the region of the image to copy
-        region.imageOffset = { 0, 0, 0 };  // Starting point (x, y, z) in the image
-        region.imageExtent = {
-            w,   // Width of the image
-            h,  // Height of the image
-            1        // Depth (for 2D images)
-        };
-        // Record the command to copy the image to the buffer
+        //copy the region from the image to the start of the frame's buffer
+        VkBufferImageCopy copy{};
+        copy.bufferOffset = 0;
+        copy.bufferRowLength = 0;  // Tightly packed (0 means the buffer has no padding)
+        copy.bufferImageHeight = 0;  // Tightly packed (0 means no padding)
+        copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy.imageSubresource.mipLevel = 0;
+        copy.imageSubresource.baseArrayLayer = 0;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageOffset = { static_cast<int32_t>(region.x), static_cast<int32_t>(region.y), 0 };
+        copy.imageExtent = { region.width, region.height, 1 };
         vkCmdCopyImageToBuffer(
-            cmd,               // Command buffer
-            gpuImage,                    // Source image (the image to copy from)
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,  // Layout of the source image
-            buffer,                   // Destination buffer (the buffer to copy to)
-            1,                           // Number of regions to copy
-            &region                      // The region information
+            cmd,
+            gpuImage,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            mReadback[frame].buffer,
+            1,
+            &copy
         );
-        //the image isn't available here yet. It'll only be available after the queue is submitted
-        // 
-        // 
-        ////Copies to the vector
-        //std::vector<uint8_t> pixels(bufferSize);
-        //void* bufferAddr = nullptr;
-        //vkMapMemory(myvk::Device::gDevice->GetDevice(), bufferMemory, 0, bufferSize, 0, &bufferAddr);
-        //memcpy(pixels.data(), bufferAddr, bufferSize);
+        //the copy has to reach the host before the fence lets the cpu read it
+        VkBufferMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostBarrier.buffer = mReadback[frame].buffer;
+        hostBarrier.offset = 0;
+        hostBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+            0, nullptr, 1, &hostBarrier, 0, nullptr);
+    }
 
+    PickerRegion GpuPickerPipeline::GetRegion(uint32_t frame)const
+    {
+        return mReadback[frame].region;
     }
 
-    std::vector<uint8_t> GpuPickerPipeline::GetImage()
+    void GpuPickerPipeline::ClearRegion(uint32_t frame)
     {
-        std::vector<uint8_t> pixels(bufferSize, 0);
-        void* bufferAddr = nullptr;
-        vkMapMemory(myvk::Device::gDevice->GetDevice(), bufferMemory, 0, bufferSize, 0, &bufferAddr);
-        memcpy(pixels.data(), bufferAddr, bufferSize);
-        vkUnmapMemory(myvk::Device::gDevice->GetDevice(), bufferMemory);
-        return pixels;
+        mReadback[frame].region = PickerRegion{};
     }
 
-}
\ No newline at end of file
+}
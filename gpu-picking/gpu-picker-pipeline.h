@@ -1,14 +1,49 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include <array>
 #include <string>
 #include <vector>
 struct VkContext;
 struct CameraUniformBuffer;
 namespace entities {
     class Renderable;
+    struct InstanceBatch;
+    struct IndirectDrawRange;
+    struct BoundDrawState;
 }
 namespace GpuPicker {
     const std::string GPU_PICKER_RENDER_PASS_TARGET = "gpuPickerRenderPassTargetImage";
+    /// <summary>
+    /// The id of the pixels where nothing was drawn, the pass clears to white.
+    /// </summary>
+    const uint32_t BACKGROUND_ID = 0xFFFFFF;
+    /// <summary>
+    /// Largest side of the square read back around the cursor, see SetReadbackSize.
+    /// </summary>
+    const uint32_t MAX_READBACK_SIZE = 16;
+    /// <summary>
+    /// Pixels of the picker image around the cursor, rgba, rows tightly packed. x and y are where
+    /// the region starts in the image, cursorX and cursorY where the cursor was in the region.
+    /// pixels is nullptr if nothing was copied (ex: the cursor was out of the image).
+    /// </summary>
+    struct PickerRegion {
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t cursorX = 0;
+        uint32_t cursorY = 0;
+        const uint8_t* pixels = nullptr;
+        /// <summary>
+        /// The id gpu_picker.frag wrote at a pixel of the region.
+        /// </summary>
+        uint32_t IdAt(uint32_t column, uint32_t row)const;
+        /// <summary>
+        /// The id of the pixel under the cursor or, if it's background, of the closest pixel
+        /// that isn't. BACKGROUND_ID if the whole region is background.
+        /// </summary>
+        uint32_t ClosestId()const;
+    };
     class GpuPickerPipeline {
     public:
         GpuPickerPipeline(VkContext* ctx,
@@ -22,14 +57,58 @@ namespace GpuPicker {
         const VkRenderPass mRenderPass;
         VkPipeline GetPipeline()const { return pipeline; }
         VkPipelineLayout GetPipelineLayout()const { return pipelineLayout; }
+        /// <summary>
+        /// Binds the pipeline and the camera set (set 0), that doesn't change during the pass.
+        /// UpdateFrameGlobals must have been called for the frame.
+        /// </summary>
         void Bind(VkCommandBuffer cmd);
-        void DrawRenderable(entities::Renderable* obj, CameraUniformBuffer* camera,
-            VkCommandBuffer cmd);
-
+        /// <summary>
+        /// Same as entities::Pipeline::DrawBatch, the fragment shader writes each instance's id as color.
+        /// </summary>
+        void DrawBatch(const entities::InstanceBatch& batch, VkCommandBuffer cmd, entities::BoundDrawState& bound);
+        /// <summary>
+        /// Same as entities::Pipeline::DrawIndirect.
+        /// </summary>
+        void DrawIndirect(const entities::IndirectDrawRange& range, VkBuffer indirectBuffer, VkCommandBuffer cmd);
+        /// <summary>
+        /// Side of the square around the cursor that ScheduleTransferImageFromGPUtoCPU copies,
+        /// clamped to [1, MAX_READBACK_SIZE]. 1 is just the pixel under the cursor, more gives
+        /// some tolerance to thin or small objects, see PickerRegion::ClosestId.
+        /// </summary>
+        void SetReadbackSize(uint32_t size);
+        uint32_t GetReadbackSize()const { return mReadbackSize; }
+        /// <summary>
+        /// Records the copy of the square around the cursor, moved inside the w x h image at the
+        /// borders, to the frame's readback buffer. Nothing is copied if the cursor is out of the
+        /// image. The image must be done with the picker pass.
+        /// </summary>
         void ScheduleTransferImageFromGPUtoCPU(VkCommandBuffer cmd,
-            VkImage gpuImage, uint32_t w, uint32_t h);
-        std::vector<uint8_t> GetImage();
+            VkImage gpuImage, uint32_t w, uint32_t h, int32_t cursorX, int32_t cursorY, uint32_t frame);
+        /// <summary>
+        /// What the last copy recorded for the frame-in-flight slot brought back. Only valid after
+        /// the slot's fence was waited for, that is after BeginFrame and before the frame records 
+        /// its own copy, so it's MAX_FRAMES_IN_FLIGHT frames late. Points to the mapped buffer,
+        /// the next copy to the slot overwrites it.
+        /// </summary>
+        PickerRegion GetRegion(uint32_t frame)const;
+        /// <summary>
+        /// Empties the slot's region, for frames that don't record a copy. Otherwise the slot
+        /// keeps the region of the last frame that did, however old it is.
+        /// </summary>
+        void ClearRegion(uint32_t frame);
     private:
+        /// <summary>
+        /// Host visible, mapped for as long as the pipeline lives. Big enough for the largest
+        /// region, with the region the last copy wrote.
+        /// </summary>
+        struct ReadbackBuffer {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            void* address = nullptr;
+            PickerRegion region;
+        };
+        std::array<ReadbackBuffer, MAX_FRAMES_IN_FLIGHT> mReadback;
+        uint32_t mReadbackSize = 1;
         VkShaderModule vertexShaderModule = VK_NULL_HANDLE;
         VkShaderModule fragmentShaderModule = VK_NULL_HANDLE;
         VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
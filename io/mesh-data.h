@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
+#include "triangle-bvh.h"
 namespace io {
     struct MeshData {
         std::string name;
@@ -9,6 +10,20 @@ namespace io {
         std::vector<uint16_t> indices;
         std::vector<glm::vec3> normals;
         std::vector<glm::vec2> uv0s;
+        /// <summary>
+        /// Axis aligned box around the vertices, in the mesh's space. Filled by LoadMeshes.
+        /// </summary>
+        glm::vec3 aabbMin = glm::vec3(0.0f);
+        glm::vec3 aabbMax = glm::vec3(0.0f);
+        /// <summary>
+        /// Sphere around the vertices, centered in the box. Filled by LoadMeshes.
+        /// </summary>
+        glm::vec3 sphereCenter = glm::vec3(0.0f);
+        float sphereRadius = 0.0f;
+        /// <summary>
+        /// Over the triangles of indices, in the mesh's space. Filled by LoadMeshes.
+        /// </summary>
+        TriangleBvh bvh;
     };
 
 }
\ No newline at end of file
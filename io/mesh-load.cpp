@@ -3,7 +3,10 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <sstream>
+#include <fstream>
 #include <filesystem>
+#include <algorithm>
+#include <cmath>
 #include "asset-paths.h"
 const aiScene* LoadScene(Assimp::Importer& importer, const std::string& path) {
     const aiScene* scene = importer.ReadFile(path.c_str(),
@@ -27,6 +30,50 @@ glm::vec4 aiVecToGlmVec(aiColor4D v) {
 }
 
 namespace io {
+    void ComputeBounds(MeshData& meshData)
+    {
+        if (meshData.vertices.empty())
+            return;
+        glm::vec3 min = meshData.vertices[0];
+        glm::vec3 max = meshData.vertices[0];
+        for (const auto& v : meshData.vertices) {
+            min = glm::min(min, v);
+            max = glm::max(max, v);
+        }
+        meshData.aabbMin = min;
+        meshData.aabbMax = max;
+        //the box's center and the farthest vertex from it, tighter than the half diagonal
+        meshData.sphereCenter = (min + max) * 0.5f;
+        float radius2 = 0.0f;
+        for (const auto& v : meshData.vertices) {
+            const glm::vec3 d = v - meshData.sphereCenter;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        meshData.sphereRadius = std::sqrt(radius2);
+    }
+
+    /// <summary>
+    /// Reads the mesh's bvh from the cache file if it's newer than the asset, otherwise builds it
+    /// and writes the cache for the next time. A cache that can't be written is not an error.
+    /// </summary>
+    static void LoadOrBuildBvh(MeshData& meshData, const std::string& assetPath, const std::string& cachePath)
+    {
+        std::error_code error;
+        const auto assetTime = std::filesystem::last_write_time(assetPath, error);
+        if (!error) {
+            const auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+            if (!error && cacheTime >= assetTime) {
+                std::ifstream cache(cachePath, std::ios::binary);
+                if (meshData.bvh.Read(cache, meshData))
+                    return;
+            }
+        }
+        meshData.bvh.Build(meshData);
+        std::ofstream cache(cachePath, std::ios::binary | std::ios::trunc);
+        if (cache)
+            meshData.bvh.Write(cache);
+    }
+
     std::vector<std::shared_ptr<MeshData>> LoadMeshes(const std::string& file)
     {
         Assimp::Importer importer;
@@ -56,6 +103,9 @@ namespace io {
             md->indices = indexData;
             assert(md->indices.size() > 0);
             assert(md->vertices.size() > 0);
+            ComputeBounds(*md);
+            //one cache per mesh of the file: monkey.glb.0.bvh, monkey.glb.1.bvh...
+            LoadOrBuildBvh(*md, path, path + "." + std::to_string(m) + ".bvh");
             result[m] = md;
         }
         return result;
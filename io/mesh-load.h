@@ -2,6 +2,14 @@
 #include <memory>
 #include "mesh-data.h"
 namespace io {
+    /// <summary>
+    /// Fills the box and the sphere of the mesh from its vertices. LoadMeshes calls it.
+    /// </summary>
+    void ComputeBounds(MeshData& meshData);
+    /// <summary>
+    /// Loads the meshes of an asset file, with their bounds and their triangle bvhs. The bvhs
+    /// are cached next to the asset, in <file>.<mesh index>.bvh.
+    /// </summary>
     std::vector<std::shared_ptr<MeshData>> LoadMeshes(
         const std::string& file
     );
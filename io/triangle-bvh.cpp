@@ -0,0 +1,365 @@
+#include "triangle-bvh.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "mesh-data.h"
+#include "utils/job-system.h"
+
+namespace io {
+    /// <summary>
+    /// Nodes with this many triangles or less aren't split.
+    /// </summary>
+    static const uint32_t MAX_TRIANGLES_PER_LEAF = 4;
+    static const uint32_t SAH_BINS = 12;
+    /// <summary>
+    /// Size of the traversal stack. Below SAH_MAX_DEPTH the splits are at the median, that
+    /// halves the triangles, so the trees Build makes can't get deeper than this. Read refuses
+    /// deeper ones.
+    /// </summary>
+    static const uint32_t MAX_DEPTH = 64;
+    static const uint32_t SAH_MAX_DEPTH = 32;
+    /// <summary>
+    /// Meshes with less triangles are built in the calling thread, the jobs would cost more
+    /// than they save.
+    /// </summary>
+    static const uint32_t PARALLEL_BUILD_TRIANGLES = 16384;
+    /// <summary>
+    /// "TBVH" and the layout version, Read refuses anything else.
+    /// </summary>
+    static const uint32_t FILE_MAGIC = 0x48564254;
+    static const uint32_t FILE_VERSION = 1;
+
+    struct TriangleBvh::BuildInput {
+        std::vector<glm::vec3> boxMin;
+        std::vector<glm::vec3> boxMax;
+        std::vector<glm::vec3> centroids;
+    };
+    /// <summary>
+    /// A range of mTriangles still to split and the node it fills.
+    /// </summary>
+    struct TriangleBvh::BuildTask {
+        uint32_t begin, end;
+        uint32_t node;
+        uint32_t depth;
+    };
+
+    static float SurfaceArea(const glm::vec3& min, const glm::vec3& max)
+    {
+        const glm::vec3 d = max - min;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    /// <summary>
+    /// Distance along the ray to where it enters the box, infinity if it misses it or enters
+    /// after maxDistance.
+    /// </summary>
+    static float RayEntersBox(const float* min, const float* max, const glm::vec3& origin,
+        const glm::vec3& inverseDirection, float maxDistance)
+    {
+        const glm::vec3 t0 = (glm::vec3(min[0], min[1], min[2]) - origin) * inverseDirection;
+        const glm::vec3 t1 = (glm::vec3(max[0], max[1], max[2]) - origin) * inverseDirection;
+        const glm::vec3 tNear = glm::min(t0, t1);
+        const glm::vec3 tFar = glm::max(t0, t1);
+        const float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return tEnter <= tExit ? tEnter : std::numeric_limits<float>::infinity();
+    }
+
+    /// <summary>
+    /// Moller-Trumbore, both sides of the triangle.
+    /// </summary>
+    static bool RayHitsTriangle(const glm::vec3& origin, const glm::vec3& direction,
+        const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t, float& u, float& v)
+    {
+        const glm::vec3 ab = b - a;
+        const glm::vec3 ac = c - a;
+        const glm::vec3 p = glm::cross(direction, ac);
+        const float determinant = glm::dot(ab, p);
+        //parallel to the triangle
+        if (std::abs(determinant) < 1e-12f)
+            return false;
+        const float inverseDeterminant = 1.0f / determinant;
+        const glm::vec3 s = origin - a;
+        u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        const glm::vec3 q = glm::cross(s, ab);
+        v = glm::dot(direction, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(ac, q) * inverseDeterminant;
+        return t >= 0.0f;
+    }
+
+    void TriangleBvh::BuildNodes(const BuildInput& input, std::vector<Node>& nodes, const BuildTask& root,
+        uint32_t deferAbove, std::vector<BuildTask>* deferred)
+    {
+        std::vector<BuildTask> tasks{ root };
+        while (!tasks.empty()) {
+            const BuildTask task = tasks.back();
+            tasks.pop_back();
+            const uint32_t count = task.end - task.begin;
+            if (deferred != nullptr && count <= deferAbove) {
+                deferred->push_back(task);
+                continue;
+            }
+            glm::vec3 min = input.boxMin[mTriangles[task.begin]];
+            glm::vec3 max = input.boxMax[mTriangles[task.begin]];
+            glm::vec3 centroidMin = input.centroids[mTriangles[task.begin]];
+            glm::vec3 centroidMax = centroidMin;
+            for (uint32_t i = task.begin + 1; i < task.end; i++) {
+                const uint32_t triangle = mTriangles[i];
+                min = glm::min(min, input.boxMin[triangle]);
+                max = glm::max(max, input.boxMax[triangle]);
+                centroidMin = glm::min(centroidMin, input.centroids[triangle]);
+                centroidMax = glm::max(centroidMax, input.centroids[triangle]);
+            }
+            Node& node = nodes[task.node];
+            for (int axis = 0; axis < 3; axis++) {
+                node.min[axis] = min[axis];
+                node.max[axis] = max[axis];
+            }
+            if (count <= MAX_TRIANGLES_PER_LEAF) {
+                node.offset = task.begin;
+                node.count = count;
+                continue;
+            }
+            const glm::vec3 extent = centroidMax - centroidMin;
+            const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            uint32_t middle = task.begin;
+            if (extent[axis] > 0.0f && task.depth < SAH_MAX_DEPTH) {
+                const float scale = SAH_BINS / extent[axis];
+                const float axisMin = centroidMin[axis];
+                auto binOf = [&](uint32_t triangle) {
+                    const uint32_t bin = static_cast<uint32_t>((input.centroids[triangle][axis] - axisMin) * scale);
+                    return std::min(bin, SAH_BINS - 1);
+                };
+                glm::vec3 binMin[SAH_BINS];
+                glm::vec3 binMax[SAH_BINS];
+                uint32_t binCounts[SAH_BINS] = {};
+                for (uint32_t i = task.begin; i < task.end; i++) {
+                    const uint32_t triangle = mTriangles[i];
+                    const uint32_t bin = binOf(triangle);
+                    binMin[bin] = binCounts[bin] == 0 ? input.boxMin[triangle] : glm::min(binMin[bin], input.boxMin[triangle]);
+                    binMax[bin] = binCounts[bin] == 0 ? input.boxMax[triangle] : glm::max(binMax[bin], input.boxMax[triangle]);
+                    binCounts[bin]++;
+                }
+                //cost of splitting after each bin, the left side swept forward and the right backwards.
+                //The first and last bins aren't empty.
+                float leftCosts[SAH_BINS - 1];
+                glm::vec3 sideMin = binMin[0];
+                glm::vec3 sideMax = binMax[0];
+                uint32_t sideCount = 0;
+                for (uint32_t b = 0; b < SAH_BINS - 1; b++) {
+                    if (binCounts[b] > 0) {
+                        sideMin = glm::min(sideMin, binMin[b]);
+                        sideMax = glm::max(sideMax, binMax[b]);
+                        sideCount += binCounts[b];
+                    }
+                    leftCosts[b] = sideCount * SurfaceArea(sideMin, sideMax);
+                }
+                float bestCost = std::numeric_limits<float>::infinity();
+                uint32_t bestBin = 0;
+                sideMin = binMin[SAH_BINS - 1];
+                sideMax = binMax[SAH_BINS - 1];
+                sideCount = 0;
+                for (uint32_t b = SAH_BINS - 1; b > 0; b--) {
+                    if (binCounts[b] > 0) {
+                        sideMin = glm::min(sideMin, binMin[b]);
+                        sideMax = glm::max(sideMax, binMax[b]);
+                        sideCount += binCounts[b];
+                    }
+                    const float cost = leftCosts[b - 1] + sideCount * SurfaceArea(sideMin, sideMax);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestBin = b - 1;
+                    }
+                }
+                middle = static_cast<uint32_t>(std::partition(mTriangles.begin() + task.begin, mTriangles.begin() + task.end,
+                    [&](uint32_t triangle) { return binOf(triangle) <= bestBin; }) - mTriangles.begin());
+            }
+            //too deep, or all the centroids in one place: half the triangles on each side
+            if (middle == task.begin || middle == task.end || task.depth >= SAH_MAX_DEPTH) {
+                middle = task.begin + count / 2;
+                std::nth_element(mTriangles.begin() + task.begin, mTriangles.begin() + middle, mTriangles.begin() + task.end,
+                    [&](uint32_t a, uint32_t b) { return input.centroids[a][axis] < input.centroids[b][axis]; });
+            }
+            //node is a reference into nodes, no more writes to it after this
+            const uint32_t left = static_cast<uint32_t>(nodes.size());
+            node.offset = left;
+            node.count = 0;
+            nodes.emplace_back();
+            nodes.emplace_back();
+            tasks.push_back({ middle, task.end, left + 1, task.depth + 1 });
+            tasks.push_back({ task.begin, middle, left, task.depth + 1 });
+        }
+    }
+
+    void TriangleBvh::Build(const MeshData& mesh)
+    {
+        mNodes.clear();
+        mTriangles.clear();
+        const uint32_t numberOfTriangles = static_cast<uint32_t>(mesh.indices.size() / 3);
+        if (numberOfTriangles == 0)
+            return;
+        BuildInput input;
+        input.boxMin.resize(numberOfTriangles);
+        input.boxMax.resize(numberOfTriangles);
+        input.centroids.resize(numberOfTriangles);
+        mTriangles.resize(numberOfTriangles);
+        for (uint32_t t = 0; t < numberOfTriangles; t++) {
+            const glm::vec3& a = mesh.vertices[mesh.indices[3 * t]];
+            const glm::vec3& b = mesh.vertices[mesh.indices[3 * t + 1]];
+            const glm::vec3& c = mesh.vertices[mesh.indices[3 * t + 2]];
+            input.boxMin[t] = glm::min(a, glm::min(b, c));
+            input.boxMax[t] = glm::max(a, glm::max(b, c));
+            input.centroids[t] = (a + b + c) / 3.0f;
+            mTriangles[t] = t;
+        }
+        //at most 2n - 1 nodes
+        mNodes.reserve(2 * numberOfTriangles);
+        mNodes.emplace_back();
+        utils::JobSystem* jobSystem = utils::JobSystem::gJobSystem;
+        if (jobSystem == nullptr || jobSystem->NumberOfThreads() == 1 || numberOfTriangles < PARALLEL_BUILD_TRIANGLES) {
+            BuildNodes(input, mNodes, { 0, numberOfTriangles, 0, 0 }, 0, nullptr);
+            return;
+        }
+        //the top of the tree here, until there are a few subtrees per thread, then the subtrees
+        //in parallel, each in its own nodes and in its own range of mTriangles
+        const uint32_t deferAbove = std::max(numberOfTriangles / (4 * jobSystem->NumberOfThreads()),
+            MAX_TRIANGLES_PER_LEAF);
+        std::vector<BuildTask> subtrees;
+        BuildNodes(input, mNodes, { 0, numberOfTriangles, 0, 0 }, deferAbove, &subtrees);
+        std::vector<std::vector<Node>> subtreeNodes(subtrees.size());
+        jobSystem->ParallelFor(static_cast<uint32_t>(subtrees.size()), 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t s = begin; s < end; s++) {
+                subtreeNodes[s].reserve(2 * (subtrees[s].end - subtrees[s].begin));
+                subtreeNodes[s].emplace_back();
+                BuildNodes(input, subtreeNodes[s], { subtrees[s].begin, subtrees[s].end, 0, subtrees[s].depth },
+                    0, nullptr);
+            }
+        });
+        //the root of each subtree replaces its empty node, the rest goes to the end. The leaves
+        //already point to the shared mTriangles, the inner nodes need their children moved.
+        for (uint32_t s = 0; s < subtrees.size(); s++) {
+            const std::vector<Node>& nodes = subtreeNodes[s];
+            const uint32_t base = static_cast<uint32_t>(mNodes.size()) - 1;
+            for (uint32_t i = 0; i < nodes.size(); i++) {
+                Node node = nodes[i];
+                if (node.count == 0)
+                    node.offset += base;
+                if (i == 0)
+                    mNodes[subtrees[s].node] = node;
+                else
+                    mNodes.push_back(node);
+            }
+        }
+    }
+
+    bool TriangleBvh::Intersect(const MeshData& mesh, const glm::vec3& origin, const glm::vec3& direction,
+        float maxDistance, TriangleHit& hit)const
+    {
+        if (mNodes.empty())
+            return false;
+        const glm::vec3 inverseDirection = 1.0f / direction;
+        if (RayEntersBox(mNodes[0].min, mNodes[0].max, origin, inverseDirection, maxDistance) > maxDistance)
+            return false;
+        bool found = false;
+        float closest = maxDistance;
+        //the nodes on the stack were hit by the ray, with the distance where it enters them
+        struct StackEntry {
+            uint32_t node;
+            float distance;
+        };
+        StackEntry stack[MAX_DEPTH];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = { 0, 0.0f };
+        while (stackSize > 0) {
+            const StackEntry entry = stack[--stackSize];
+            //something closer was found after it was pushed
+            if (entry.distance > closest)
+                continue;
+            const Node& node = mNodes[entry.node];
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    const uint32_t triangle = mTriangles[i];
+                    float t, u, v;
+                    if (RayHitsTriangle(origin, direction, mesh.vertices[mesh.indices[3 * triangle]],
+                        mesh.vertices[mesh.indices[3 * triangle + 1]], mesh.vertices[mesh.indices[3 * triangle + 2]],
+                        t, u, v) && t < closest) {
+                        closest = t;
+                        hit = { triangle, t, u, v };
+                        found = true;
+                    }
+                }
+                continue;
+            }
+            //the nearest child on top, it's visited first and shrinks closest for the other one
+            const uint32_t left = node.offset;
+            const uint32_t right = node.offset + 1;
+            const float leftDistance = RayEntersBox(mNodes[left].min, mNodes[left].max, origin, inverseDirection, closest);
+            const float rightDistance = RayEntersBox(mNodes[right].min, mNodes[right].max, origin, inverseDirection, closest);
+            if (leftDistance <= rightDistance) {
+                if (rightDistance <= closest)
+                    stack[stackSize++] = { right, rightDistance };
+                if (leftDistance <= closest)
+                    stack[stackSize++] = { left, leftDistance };
+            }
+            else {
+                if (leftDistance <= closest)
+                    stack[stackSize++] = { left, leftDistance };
+                if (rightDistance <= closest)
+                    stack[stackSize++] = { right, rightDistance };
+            }
+        }
+        return found;
+    }
+
+    void TriangleBvh::Write(std::ostream& stream)const
+    {
+        const uint32_t header[4] = { FILE_MAGIC, FILE_VERSION,
+            static_cast<uint32_t>(mTriangles.size()), static_cast<uint32_t>(mNodes.size()) };
+        stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(mNodes.data()), mNodes.size() * sizeof(Node));
+        stream.write(reinterpret_cast<const char*>(mTriangles.data()), mTriangles.size() * sizeof(uint32_t));
+    }
+
+    bool TriangleBvh::Read(std::istream& stream, const MeshData& mesh)
+    {
+        mNodes.clear();
+        mTriangles.clear();
+        const uint32_t numberOfTriangles = static_cast<uint32_t>(mesh.indices.size() / 3);
+        uint32_t header[4];
+        if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)))
+            return false;
+        const uint32_t numberOfNodes = header[3];
+        if (header[0] != FILE_MAGIC || header[1] != FILE_VERSION || header[2] != numberOfTriangles ||
+            numberOfNodes == 0 || numberOfNodes >= 2 * numberOfTriangles)
+            return false;
+        mNodes.resize(numberOfNodes);
+        mTriangles.resize(numberOfTriangles);
+        bool valid = stream.read(reinterpret_cast<char*>(mNodes.data()), numberOfNodes * sizeof(Node)) &&
+            stream.read(reinterpret_cast<char*>(mTriangles.data()), numberOfTriangles * sizeof(uint32_t));
+        //the queries trust the indices and the depth, a bad file must not get past here. The
+        //children come after their parent, so one pass in order sees every parent's depth before
+        //its children's. Intersect's stack holds at most depth + 1 nodes.
+        std::vector<uint32_t> depths(valid ? numberOfNodes : 0, 0);
+        for (uint32_t i = 0; valid && i < numberOfNodes; i++) {
+            const Node& node = mNodes[i];
+            valid = node.count == 0 ? node.offset > i && node.offset + 1 < numberOfNodes :
+                static_cast<uint64_t>(node.offset) + node.count <= numberOfTriangles;
+            if (valid && node.count == 0) {
+                valid = depths[i] + 1 < MAX_DEPTH;
+                depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+                depths[node.offset + 1] = std::max(depths[node.offset + 1], depths[i] + 1);
+            }
+        }
+        for (uint32_t i = 0; valid && i < numberOfTriangles; i++)
+            valid = mTriangles[i] < numberOfTriangles;
+        if (!valid) {
+            mNodes.clear();
+            mTriangles.clear();
+        }
+        return valid;
+    }
+}
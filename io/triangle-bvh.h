@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <glm/glm.hpp>
+namespace io {
+    struct MeshData;
+    /// <summary>
+    /// Where a ray hit a mesh. distance is along the ray in units of the ray's direction, u and v
+    /// are the barycentric coordinates of the second and third vertices of the triangle.
+    /// </summary>
+    struct TriangleHit {
+        uint32_t triangle = 0;
+        float distance = 0.0f;
+        float u = 0.0f;
+        float v = 0.0f;
+    };
+    /// <summary>
+    /// Bounding volume hierarchy over the triangles of a mesh, in the mesh's space, for ray
+    /// queries against the exact geometry. Doesn't keep the mesh, the queries take the same
+    /// MeshData it was built from. LoadMeshes builds it, or reads it from the mesh's cache.
+    /// </summary>
+    class TriangleBvh {
+    public:
+        /// <summary>
+        /// Builds the tree over the triangles of the mesh's index list, splitting where the
+        /// surface area heuristic says. Big meshes are built in parallel over
+        /// utils::JobSystem::gJobSystem when there is one.
+        /// </summary>
+        void Build(const MeshData& mesh);
+        /// <summary>
+        /// Closest triangle the ray hits before maxDistance, from either side. Returns false
+        /// if there's none.
+        /// </summary>
+        bool Intersect(const MeshData& mesh, const glm::vec3& origin, const glm::vec3& direction,
+            float maxDistance, TriangleHit& hit)const;
+        bool IsEmpty()const { return mNodes.empty(); }
+        /// <summary>
+        /// Writes the nodes and the triangle order as they are in memory, Read takes them back.
+        /// </summary>
+        void Write(std::ostream& stream)const;
+        /// <summary>
+        /// Reads what Write wrote for the same mesh. Returns false, and leaves the tree empty, if
+        /// the data is from another version, another mesh or is broken.
+        /// </summary>
+        bool Read(std::istream& stream, const MeshData& mesh);
+        uint32_t NumberOfNodes()const { return static_cast<uint32_t>(mNodes.size()); }
+    private:
+        /// <summary>
+        /// Two nodes per 64 byte cache line. The box is in plain floats, the aligned glm vec3s
+        /// would take 16 bytes each. The two children of an inner node are next to each other.
+        /// </summary>
+        struct alignas(32) Node {
+            float min[3];
+            /// <summary>
+            /// Leaves: the first triangle in mTriangles. Inner nodes: the left child.
+            /// </summary>
+            uint32_t offset = 0;
+            float max[3];
+            /// <summary>
+            /// Number of triangles of a leaf, 0 for inner nodes.
+            /// </summary>
+            uint32_t count = 0;
+        };
+        static_assert(sizeof(Node) == 32, "two nodes per cache line");
+        struct BuildInput;
+        struct BuildTask;
+        /// <summary>
+        /// Splits the task's range into nodes, depth first. The ranges of deferAbove triangles or
+        /// less are left to be built apart, they go to deferred and their node stays empty.
+        /// </summary>
+        void BuildNodes(const BuildInput& input, std::vector<Node>& nodes, const BuildTask& root,
+            uint32_t deferAbove, std::vector<BuildTask>* deferred);
+        std::vector<Node> mNodes;
+        /// <summary>
+        /// Triangle indices, the leaves' ranges point here.
+        /// </summary>
+        std::vector<uint32_t> mTriangles;
+    };
+}
@@ -1,7 +1,6 @@
 #version 450
-layout(push_constant) uniform PushConstants {
-    int id;  // Add your integer here
-} pushConstants;
+//the instance's object id, from the vertex shader
+layout(location = 0) flat in uint objectId;
 layout(location = 0) out vec4 outColor;
 
 vec3 idToColor(int id) {
@@ -16,5 +15,5 @@ vec3 idToColor(int id) {
 }
 
 void main() {
-    outColor = vec4(idToColor(pushConstants.id),1);
+    outColor = vec4(idToColor(int(objectId)),1);
 }
\ No newline at end of file
@@ -6,15 +6,26 @@ layout(set = 0, binding = 0) uniform CameraUniformBuffer {
     mat4 proj;
 } cameraUniform;
 
-layout(set = 1, binding = 0) uniform ObjectUniformBuffer {
+struct ObjectRecord {
     mat4 model;
-} objectUniform;
+    uint objectId;
+};
+//the records of the objects in one page of the pool, see GameObjectUniformBufferPool
+layout(std430, set = 1, binding = 0) readonly buffer ObjectRecords {
+    ObjectRecord records[];
+} objectRecords;
+//same as game-object.h
+const uint GAME_OBJECTS_PER_PAGE = 1024;
 
 layout(location=0) in vec3 inPosition;
 layout(location=1) in vec2 inUV0;
 layout(location=2) in vec3 inColor;
+//per instance
+layout(location=3) in uint inObjectId;
 
+layout(location = 0) flat out uint objectId;
 
 void main() {
-    gl_Position = cameraUniform.proj * cameraUniform.view * objectUniform.model * vec4(inPosition, 1.0);
+    gl_Position = cameraUniform.proj * cameraUniform.view * objectRecords.records[inObjectId % GAME_OBJECTS_PER_PAGE].model * vec4(inPosition, 1.0);
+    objectId = inObjectId;
 }
\ No newline at end of file
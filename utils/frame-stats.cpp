@@ -0,0 +1,3 @@
+#include "frame-stats.h"
+
+FrameStats gFrameStats{};
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+/// <summary>
+/// Counters for the work done in a frame. DrawFrame resets them when the frame begins and
+/// whoever does the work increments them. They are read by the benchmark and the demo.
+/// </summary>
+struct FrameStats {
+    /// <summary>
+    /// Number of draw commands recorded in the frame, all passes included. An indirect draw
+    /// counts once however many commands it reads. Atomic because the draws may be recorded 
+    /// from several threads.
+    /// </summary>
+    std::atomic<uint32_t> drawCalls{ 0 };
+    /// <summary>
+    /// State changes recorded in the frame, all passes included: vkCmdBindPipeline calls, 
+    /// vkCmdBindDescriptorSets calls and mesh binds (vertex and index buffer together). 
+    /// The binds the draws skip because the state was already there aren't counted.
+    /// </summary>
+    std::atomic<uint32_t> pipelineBinds{ 0 };
+    std::atomic<uint32_t> descriptorSetBinds{ 0 };
+    std::atomic<uint32_t> meshBinds{ 0 };
+    /// <summary>
+    /// Number of objects whose transform was computed and written in the frame. Static 
+    /// objects aren't counted.
+    /// </summary>
+    uint32_t transformsUpdated = 0;
+    /// <summary>
+    /// Number of renderables left out of the frame because their bounds are outside the camera's
+    /// frustum, and because they are behind what was drawn. When the gpu culls they come from the
+    /// gpu, and like gpuFrameMs they are from the last frame that finished on this slot.
+    /// </summary>
+    uint32_t objectsCulled = 0;
+    uint32_t objectsOccluded = 0;
+    /// <summary>
+    /// Gpu time, in ms, of the last frame that finished on this frame-in-flight slot. Gpu 
+    /// results arrive MAX_FRAMES_IN_FLIGHT frames late so we never wait for them. 
+    /// Negative while unknown.
+    /// </summary>
+    double gpuFrameMs = -1.0;
+    void Reset() {
+        drawCalls = 0;
+        pipelineBinds = 0;
+        descriptorSetBinds = 0;
+        meshBinds = 0;
+        transformsUpdated = 0;
+        objectsCulled = 0;
+        objectsOccluded = 0;
+        gpuFrameMs = -1.0;
+    }
+};
+extern FrameStats gFrameStats;
@@ -0,0 +1,40 @@
+#include "id-allocator.h"
+
+namespace utils {
+    IdHandle IdAllocator::Allocate()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        IdHandle handle;
+        if (!mFreeList.empty()) {
+            handle.index = mFreeList.back();
+            mFreeList.pop_back();
+        }
+        else {
+            handle.index = static_cast<uint32_t>(mGenerations.size());
+            mGenerations.push_back(0);
+        }
+        handle.generation = ++mGenerations[handle.index];
+        return handle;
+    }
+
+    void IdAllocator::Free(IdHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (handle.index >= mGenerations.size() || mGenerations[handle.index] != handle.generation)
+            return;
+        ++mGenerations[handle.index];
+        mFreeList.push_back(handle.index);
+    }
+
+    bool IdAllocator::IsAlive(IdHandle handle) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return handle.index < mGenerations.size() && mGenerations[handle.index] == handle.generation;
+    }
+
+    uint32_t IdAllocator::HighWaterMark() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return static_cast<uint32_t>(mGenerations.size());
+    }
+}
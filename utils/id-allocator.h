@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <vector>
+namespace utils {
+    /// <summary>
+    /// An id plus the generation it had when allocated. When the id is freed its generation
+    /// changes, so a handle that outlived its object can be told apart from the new owner of the id.
+    /// </summary>
+    struct IdHandle {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+    };
+    /// <summary>
+    /// Hands out dense ids in [0, HighWaterMark()). Freed ids go to a free list and are reused
+    /// before new ones are created, both operations are O(1). 
+    /// Thread-safe: loaders can create objects from their own threads.
+    /// </summary>
+    class IdAllocator {
+    public:
+        IdHandle Allocate();
+        /// <summary>
+        /// Gives the id back. Freeing a stale handle is ignored.
+        /// </summary>
+        void Free(IdHandle handle);
+        /// <summary>
+        /// True if the handle's id wasn't freed since the handle was allocated.
+        /// </summary>
+        bool IsAlive(IdHandle handle)const;
+        /// <summary>
+        /// Number of ids ever created, alive or free.
+        /// </summary>
+        uint32_t HighWaterMark()const;
+    private:
+        mutable std::mutex mMutex;
+        /// <summary>
+        /// Current generation of each id. Odd while the id is allocated, even while it's free.
+        /// </summary>
+        std::vector<uint32_t> mGenerations;
+        std::vector<uint32_t> mFreeList;
+    };
+}
@@ -0,0 +1,188 @@
+#include "job-system.h"
+#include <algorithm>
+#include <cassert>
+
+namespace utils {
+    JobSystem* JobSystem::gJobSystem = nullptr;
+    /// <summary>
+    /// Index of the thread in the job system that owns it, -1 for the others.
+    /// </summary>
+    static thread_local int32_t tThreadIndex = -1;
+    /// <summary>
+    /// How many times an idle worker looks for work before going to sleep.
+    /// </summary>
+    static const uint32_t SPINS_BEFORE_SLEEP = 64;
+
+    JobDeque::JobDeque() :mJobs(new std::atomic<Job*>[CAPACITY])
+    {
+        for (uint32_t i = 0; i < CAPACITY; i++)
+            mJobs[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    bool JobDeque::Push(Job* job)
+    {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        const int64_t top = mTop.load(std::memory_order_acquire);
+        if (bottom - top >= static_cast<int64_t>(CAPACITY))
+            return false;
+        mJobs[bottom % CAPACITY].store(job, std::memory_order_relaxed);
+        //publishes the job, and everything the owner wrote before, to the thieves
+        mBottom.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    Job* JobDeque::Pop()
+    {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        mBottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = mTop.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            //empty
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job* job = mJobs[bottom % CAPACITY].load(std::memory_order_relaxed);
+        if (top == bottom) {
+            //last one, race the thieves for it
+            if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job* JobDeque::Steal()
+    {
+        int64_t top = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = mBottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return nullptr;
+        Job* job = mJobs[top % CAPACITY].load(std::memory_order_relaxed);
+        if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+    JobSystem::JobSystem(uint32_t numberOfThreads)
+    {
+        assert(gJobSystem == nullptr);
+        if (numberOfThreads == 0)
+            numberOfThreads = std::max(1u, std::thread::hardware_concurrency());
+        for (uint32_t i = 0; i < numberOfThreads; i++)
+            mDeques.emplace_back(new JobDeque());
+        tThreadIndex = 0;
+        for (uint32_t i = 1; i < numberOfThreads; i++)
+            mThreads.emplace_back(&JobSystem::WorkerLoop, this, i);
+        gJobSystem = this;
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+            mQuit = true;
+        }
+        mWakeUp.notify_all();
+        for (auto& thread : mThreads)
+            thread.join();
+        tThreadIndex = -1;
+        gJobSystem = nullptr;
+    }
+
+    int32_t JobSystem::ThreadIndex()
+    {
+        return tThreadIndex;
+    }
+
+    void JobSystem::Run(Job* job)
+    {
+        (*job->function)(job->begin, job->end);
+        job->pending->fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    Job* JobSystem::FindJob(uint32_t index)
+    {
+        Job* job = mDeques[index]->Pop();
+        if (job != nullptr)
+            return job;
+        //start stealing from the next one so that the thieves don't all hit the same deque
+        const uint32_t n = NumberOfThreads();
+        for (uint32_t i = 1; i < n; i++) {
+            job = mDeques[(index + i) % n]->Steal();
+            if (job != nullptr)
+                return job;
+        }
+        return nullptr;
+    }
+
+    void JobSystem::WorkerLoop(uint32_t index)
+    {
+        tThreadIndex = static_cast<int32_t>(index);
+        uint32_t spins = 0;
+        while (!mQuit) {
+            Job* job = FindJob(index);
+            if (job != nullptr) {
+                mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                Run(job);
+                spins = 0;
+                continue;
+            }
+            if (++spins < SPINS_BEFORE_SLEEP) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mSleepMutex);
+            mWakeUp.wait(lock, [this]() { return mQuit || mQueuedJobs.load(std::memory_order_relaxed) > 0; });
+            spins = 0;
+        }
+    }
+
+    void JobSystem::ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& function)
+    {
+        if (count == 0)
+            return;
+        grainSize = std::max(1u, grainSize);
+        const int32_t index = tThreadIndex;
+        //not one of ours, or not worth splitting
+        if (index < 0 || count <= grainSize || NumberOfThreads() == 1) {
+            function(0, count);
+            return;
+        }
+        const uint32_t numberOfJobs = (count + grainSize - 1) / grainSize;
+        std::vector<Job> jobs(numberOfJobs);
+        std::atomic<uint32_t> pending{ numberOfJobs };
+        JobDeque& deque = *mDeques[index];
+        uint32_t queued = 0;
+        for (uint32_t i = 0; i < numberOfJobs; i++) {
+            jobs[i].function = &function;
+            jobs[i].begin = i * grainSize;
+            jobs[i].end = std::min(count, (i + 1) * grainSize);
+            jobs[i].pending = &pending;
+            if (deque.Push(&jobs[i]))
+                queued++;
+            else
+                Run(&jobs[i]);//deque full, do it here
+        }
+        if (queued > 0) {
+            {
+                //under the lock so that a worker can't miss the wake up between its check and its wait
+                std::lock_guard<std::mutex> lock(mSleepMutex);
+                mQueuedJobs.fetch_add(static_cast<int32_t>(queued), std::memory_order_relaxed);
+            }
+            mWakeUp.notify_all();
+        }
+        //help until every range is done, the jobs live in this stack frame
+        while (pending.load(std::memory_order_acquire) > 0) {
+            Job* job = FindJob(static_cast<uint32_t>(index));
+            if (job != nullptr) {
+                mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                Run(job);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
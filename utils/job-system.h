@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+namespace utils {
+    /// <summary>
+    /// A range of a parallel-for, what the workers run.
+    /// </summary>
+    struct Job {
+        const std::function<void(uint32_t, uint32_t)>* function = nullptr;
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        /// <summary>
+        /// Counter of the ParallelFor the job belongs to, decremented when the job is done.
+        /// </summary>
+        std::atomic<uint32_t>* pending = nullptr;
+    };
+    /// <summary>
+    /// Chase-Lev work-stealing deque with fixed capacity. The owner pushes and pops at the bottom
+    /// without locks, the other threads steal from the top with a CAS.
+    /// </summary>
+    class JobDeque {
+    public:
+        static const uint32_t CAPACITY = 4096;
+        JobDeque();
+        /// <summary>
+        /// Owner only. Returns false if the deque is full, then the caller runs the job itself.
+        /// </summary>
+        bool Push(Job* job);
+        /// <summary>
+        /// Owner only. Newest job first, nullptr if empty.
+        /// </summary>
+        Job* Pop();
+        /// <summary>
+        /// Any thread. Oldest job first, nullptr if empty or if it lost the race for the job.
+        /// </summary>
+        Job* Steal();
+    private:
+        std::atomic<int64_t> mTop{ 0 };
+        std::atomic<int64_t> mBottom{ 0 };
+        std::unique_ptr<std::atomic<Job*>[]> mJobs;
+    };
+    /// <summary>
+    /// Fixed pool of worker threads, each with its own JobDeque. Idle threads steal from the
+    /// others, so the ranges of a ParallelFor even out between cores.
+    /// The thread that creates the job system takes part as worker 0, ParallelFor can be called
+    /// from it or from inside a job. From any other thread ParallelFor just runs the function.
+    /// Like the device, it fills gJobSystem when created.
+    /// </summary>
+    class JobSystem {
+    public:
+        static JobSystem* gJobSystem;
+        /// <summary>
+        /// numberOfThreads counts the calling thread, 0 means one per hardware thread.
+        /// </summary>
+        JobSystem(uint32_t numberOfThreads = 0);
+        ~JobSystem();
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+        /// <summary>
+        /// Calls function(begin, end) for ranges of at most grainSize that cover [0, count), in
+        /// parallel, and returns when all ranges are done. The calling thread works too.
+        /// </summary>
+        void ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& function);
+        /// <summary>
+        /// Worker threads plus the thread that created the job system.
+        /// </summary>
+        uint32_t NumberOfThreads()const { return static_cast<uint32_t>(mDeques.size()); }
+        /// <summary>
+        /// Index of the current thread in [0, NumberOfThreads()) or -1 if it's not part of the job system.
+        /// </summary>
+        static int32_t ThreadIndex();
+    private:
+        void WorkerLoop(uint32_t index);
+        /// <summary>
+        /// Pops from the thread's own deque, or steals from the others. nullptr if there was nothing.
+        /// </summary>
+        Job* FindJob(uint32_t index);
+        static void Run(Job* job);
+        std::vector<std::unique_ptr<JobDeque>> mDeques;
+        std::vector<std::thread> mThreads;
+        std::atomic<bool> mQuit{ false };
+        /// <summary>
+        /// Jobs pushed and not yet picked up, the workers sleep when it's 0.
+        /// </summary>
+        std::atomic<int32_t> mQueuedJobs{ 0 };
+        std::mutex mSleepMutex;
+        std::condition_variable mWakeUp;
+    };
+}
@@ -1,6 +1,6 @@
 #include "utils/object_namer.h"
 #include <cassert>
-#include "vk\my-device.h"
+#include "vk/my-device.h"
 VkDevice vk::ObjectNamer::gDevice;
 namespace vk {
     void vk::ObjectNamer::Init()
@@ -30,5 +30,7 @@ void SetMark(std::array<float, 4> color,
     std::string name,
     VkCommandBuffer cmd,
     VkContext ctx);
+//Closes the region opened by SetMark. Both are no-ops if VK_EXT_debug_marker is not enabled.
+void EndMark(VkCommandBuffer cmd);
 //A more concise way of setting the name of vulkan objects, i want to write less
 #define SET_NAME(obj, type, name) vk::ObjectNamer::Instance().SetName(TO_HANDLE(obj), type, name);
\ No newline at end of file
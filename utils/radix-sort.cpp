@@ -0,0 +1,49 @@
+#include "radix-sort.h"
+#include <array>
+#include <utility>
+
+namespace utils {
+    /// <summary>
+    /// 8 bit digits, 8 of them in a 64 bit key.
+    /// </summary>
+    static const uint32_t RADIX_BITS = 8;
+    static const uint32_t RADIX = 1 << RADIX_BITS;
+    static const uint32_t NUMBER_OF_DIGITS = 64 / RADIX_BITS;
+
+    void RadixSort(std::vector<SortKey>& keys, std::vector<SortKey>& scratch)
+    {
+        const uint32_t count = static_cast<uint32_t>(keys.size());
+        if (count < 2)
+            return;
+        scratch.resize(count);
+        //the histograms of every digit in a single read of the keys
+        std::array<std::array<uint32_t, RADIX>, NUMBER_OF_DIGITS> histograms{};
+        for (const SortKey& k : keys) {
+            for (uint32_t digit = 0; digit < NUMBER_OF_DIGITS; digit++) {
+                histograms[digit][(k.key >> (digit * RADIX_BITS)) & (RADIX - 1)]++;
+            }
+        }
+        std::vector<SortKey>* src = &keys;
+        std::vector<SortKey>* dst = &scratch;
+        for (uint32_t digit = 0; digit < NUMBER_OF_DIGITS; digit++) {
+            const uint32_t shift = digit * RADIX_BITS;
+            auto& histogram = histograms[digit];
+            //every key has the same digit here, the pass wouldn't move anything
+            if (histogram[(keys[0].key >> shift) & (RADIX - 1)] == count)
+                continue;
+            std::array<uint32_t, RADIX> offsets;
+            uint32_t sum = 0;
+            for (uint32_t i = 0; i < RADIX; i++) {
+                offsets[i] = sum;
+                sum += histogram[i];
+            }
+            for (const SortKey& k : *src) {
+                (*dst)[offsets[(k.key >> shift) & (RADIX - 1)]++] = k;
+            }
+            std::swap(src, dst);
+        }
+        //an odd number of passes leaves the result in scratch
+        if (src != &keys)
+            keys.swap(scratch);
+    }
+}
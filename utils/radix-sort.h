@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+namespace utils {
+    /// <summary>
+    /// A sort key and the index of the element it belongs to.
+    /// </summary>
+    struct SortKey {
+        uint64_t key;
+        uint32_t index;
+    };
+    /// <summary>
+    /// Sorts by key with a LSD radix sort of 8 bit digits, stable. scratch is where the passes 
+    /// scatter to, it's resized as needed and can be kept between calls to not allocate.
+    /// The digits that are the same in every key are skipped, so keys that use few bits are cheap.
+    /// </summary>
+    void RadixSort(std::vector<SortKey>& keys, std::vector<SortKey>& scratch);
+}
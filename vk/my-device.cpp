@@ -4,6 +4,7 @@
 #include <vector>
 #include "utils/object_namer.h"
 #include <stdexcept>
+#include <cstring>
 namespace myvk {
     Device* Device::gDevice;
 
@@ -12,15 +13,20 @@ namespace myvk {
     {
         assert(physicalDevice != VK_NULL_HANDLE);
         assert(instance != VK_NULL_HANDLE);
-        assert(surface != VK_NULL_HANDLE);
         assert(gDevice == nullptr);
         gDevice = this;
         //Get the queue families. They can be equal, and in that case that means that
         //the queue can do both presentation and graphics
         auto graphicsQueueFamilyIdx = FindGraphicsQueueFamily(physicalDevice);
-        auto presentationQueueFamilyIdx = FindPresentationQueueFamily(physicalDevice,surface);
         this->mGraphicsQueueFamily = *graphicsQueueFamilyIdx;
-        this->mPresentationQueueFamily = *presentationQueueFamilyIdx;
+        //headless devices have no surface, nothing is presented so the graphics queue stands in
+        if (surface != VK_NULL_HANDLE) {
+            auto presentationQueueFamilyIdx = FindPresentationQueueFamily(physicalDevice, surface);
+            this->mPresentationQueueFamily = *presentationQueueFamilyIdx;
+        }
+        else {
+            this->mPresentationQueueFamily = mGraphicsQueueFamily;
+        }
         //for each unique queue family id we create a queue info
         std::set<uint32_t> uniqueQueueFamilies = { mGraphicsQueueFamily, mPresentationQueueFamily };
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
@@ -44,11 +50,25 @@ namespace myvk {
         vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
         deviceFeatures.samplerAnisotropy = VK_TRUE;
         deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+        mEnabledFeatures = deviceFeatures;
         //The logical device extensions that i want
-        const std::vector<const char*> deviceExtensions = {
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME, //swapchain
-            VK_EXT_DEBUG_MARKER_EXTENSION_NAME //renderdoc marker
-        };
+        std::vector<const char*> deviceExtensions;
+        //the renderdoc marker is only there if some layer provides it, software drivers like lavapipe
+        //don't have it. SetMark/EndMark become no-ops when it's missing.
+        uint32_t availableExtensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, 
+            availableExtensions.data());
+        for (const auto& ext : availableExtensions) {
+            if (strcmp(ext.extensionName, VK_EXT_DEBUG_MARKER_EXTENSION_NAME) == 0) {
+                deviceExtensions.push_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME); //renderdoc marker
+                break;
+            }
+        }
+        if (surface != VK_NULL_HANDLE) {
+            deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME); //swapchain
+        }
         deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
         deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
         //the layers enabled on this logical device
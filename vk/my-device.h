@@ -18,6 +18,8 @@ namespace myvk {
         /// - Fills gDevice.
         /// - Initializes the VkDevice, its queues and command pool
         /// - Initializes the object namer that is used for debugging
+        /// If surface is VK_NULL_HANDLE the device is headless: no swapchain extension
+        /// and the presentation queue is the graphics queue.
         /// </summary>
         /// <param name="physicalDevice"></param>
         /// <param name="instance"></param>
@@ -38,6 +40,10 @@ namespace myvk {
         uint32_t GetPresentationQueueFamily()const { return mPresentationQueueFamily; }
         VkQueue GetGraphicsQueue()const { return mGraphicsQueue; }
         VkQueue GetPresentationQueue()const { return mPresentationQueue; }
+        /// <summary>
+        /// The features the device was created with: everything the physical device supports.
+        /// </summary>
+        const VkPhysicalDeviceFeatures& GetEnabledFeatures()const { return mEnabledFeatures; }
 
     private:
         const VkPhysicalDevice mPhysicalDevice;
@@ -49,6 +55,7 @@ namespace myvk {
         uint32_t mGraphicsQueueFamily;
         uint32_t mPresentationQueueFamily;
         VkCommandPool mCommandPool;
+        VkPhysicalDeviceFeatures mEnabledFeatures;
         std::optional<uint32_t> FindGraphicsQueueFamily(VkPhysicalDevice device);
         std::optional<uint32_t> FindPresentationQueueFamily(VkPhysicalDevice device, 
             VkSurfaceKHR surface);
@@ -0,0 +1,136 @@
+#include "my-gpu-profiler.h"
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include "my-device.h"
+#include "my-instance.h"
+#include "utils/object_namer.h"
+#include "utils/concatenate.h"
+
+namespace myvk {
+    GpuProfiler* GpuProfiler::gGpuProfiler = nullptr;
+
+    GpuProfiler::GpuProfiler(uint32_t maxScopesPerFrame)
+        :mMaxScopesPerFrame(maxScopesPerFrame)
+    {
+        assert(gGpuProfiler == nullptr);
+        assert(Device::gDevice != nullptr);
+        gGpuProfiler = this;
+        VkPhysicalDevice physicalDevice = Instance::gInstance->GetPhysicalDevice();
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        uint32_t validBits = queueFamilies[Device::gDevice->GetGraphicsQueueFamily()].timestampValidBits;
+        if (validBits == 0) {
+            printf("WARNING, the graphics queue has no timestamps, the gpu profiler is disabled.\n");
+            return;
+        }
+        mTimestampMask = validBits >= 64 ? UINT64_MAX : ((uint64_t(1) << validBits) - 1);
+        mTimestampPeriod = properties.limits.timestampPeriod;
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2 * mMaxScopesPerFrame;
+            if (vkCreateQueryPool(Device::gDevice->GetDevice(), &queryPoolInfo, nullptr, &mFrames[i].pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create the gpu profiler query pool!");
+            }
+            SET_NAME(mFrames[i].pool, VK_OBJECT_TYPE_QUERY_POOL, Concatenate("GpuProfilerQueryPool", i).c_str());
+            mFrames[i].names.reserve(mMaxScopesPerFrame);
+        }
+        mTimestamps.resize(2 * mMaxScopesPerFrame);
+        mResults.reserve(mMaxScopesPerFrame);
+        mEnabled = true;
+    }
+
+    GpuProfiler::~GpuProfiler()
+    {
+        for (auto& frame : mFrames) {
+            if (frame.pool != VK_NULL_HANDLE)
+                vkDestroyQueryPool(Device::gDevice->GetDevice(), frame.pool, nullptr);
+        }
+        gGpuProfiler = nullptr;
+    }
+
+    void GpuProfiler::BeginFrame(VkCommandBuffer cmd, uint32_t currentFrame)
+    {
+        if (!mEnabled)
+            return;
+        mCurrentFrame = currentFrame;
+        FrameQueries& frame = mFrames[mCurrentFrame];
+        if (frame.pending && frame.numberOfScopes > 0) {
+            //no WAIT bit: the fence was signaled so the stamps are there. If for some reason they
+            //aren't we get VK_NOT_READY and keep the old results.
+            VkResult result = vkGetQueryPoolResults(Device::gDevice->GetDevice(), frame.pool,
+                0, 2 * frame.numberOfScopes,
+                sizeof(uint64_t) * 2 * frame.numberOfScopes, mTimestamps.data(), sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT);
+            if (result == VK_SUCCESS) {
+                mResults.clear();
+                for (uint32_t i = 0; i < frame.numberOfScopes; i++) {
+                    uint64_t begin = mTimestamps[2 * i] & mTimestampMask;
+                    uint64_t end = mTimestamps[2 * i + 1] & mTimestampMask;
+                    uint64_t ticks = (end - begin) & mTimestampMask;
+                    mResults.push_back({ frame.names[i], ticks * mTimestampPeriod / 1000000.0 });
+                }
+            }
+        }
+        frame.pending = false;
+        frame.numberOfScopes = 0;
+        frame.names.clear();
+        vkCmdResetQueryPool(cmd, frame.pool, 0, 2 * mMaxScopesPerFrame);
+    }
+
+    void GpuProfiler::EndFrame()
+    {
+        if (!mEnabled)
+            return;
+        mFrames[mCurrentFrame].pending = true;
+    }
+
+    uint32_t GpuProfiler::BeginScope(VkCommandBuffer cmd, const std::string& name)
+    {
+        if (!mEnabled)
+            return INVALID_SCOPE;
+        FrameQueries& frame = mFrames[mCurrentFrame];
+        if (frame.numberOfScopes == mMaxScopesPerFrame)
+            return INVALID_SCOPE;
+        uint32_t scope = frame.numberOfScopes++;
+        frame.names.push_back(name);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.pool, 2 * scope);
+        return scope;
+    }
+
+    void GpuProfiler::EndScope(VkCommandBuffer cmd, uint32_t scope)
+    {
+        if (!mEnabled || scope == INVALID_SCOPE)
+            return;
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mFrames[mCurrentFrame].pool, 2 * scope + 1);
+    }
+
+    uint32_t GpuProfiler::BeginDrawScope(VkCommandBuffer cmd, const std::string& name)
+    {
+        if (gGpuProfiler == nullptr || !gGpuProfiler->mProfileDraws)
+            return INVALID_SCOPE;
+        return gGpuProfiler->BeginScope(cmd, name);
+    }
+
+    void GpuProfiler::EndDrawScope(VkCommandBuffer cmd, uint32_t scope)
+    {
+        if (gGpuProfiler == nullptr)
+            return;
+        gGpuProfiler->EndScope(cmd, scope);
+    }
+
+    double GpuProfiler::GetScopeMs(const std::string& name) const
+    {
+        for (const auto& r : mResults) {
+            if (r.name == name)
+                return r.ms;
+        }
+        return -1.0;
+    }
+}
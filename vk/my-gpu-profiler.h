@@ -0,0 +1,101 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace myvk {
+    /// <summary>
+    /// Time, in ms, that the gpu took between the begin and end stamps of a scope.
+    /// </summary>
+    struct GpuScopeResult {
+        std::string name;
+        double ms;
+    };
+    /// <summary>
+    /// Measures gpu time of named scopes (render passes, copies, draws) with timestamp queries.
+    /// There's one query pool per frame in flight, and the results of a frame are read when its 
+    /// slot comes around again, after BeginFrame waited on the slot's fence, so reading never 
+    /// stalls. Results are MAX_FRAMES_IN_FLIGHT frames late.
+    /// Like the device, it fills gGpuProfiler when created so that the pipelines can reach it.
+    /// </summary>
+    class GpuProfiler {
+    public:
+        static GpuProfiler* gGpuProfiler;
+        /// <summary>
+        /// Value returned by BeginScope when the scope isn't recorded (profiler disabled or out
+        /// of queries). EndScope ignores it.
+        /// </summary>
+        static const uint32_t INVALID_SCOPE = UINT32_MAX;
+        /// <summary>
+        /// Creates the query pools. Requires myvk::Instance::gInstance and myvk::Device::gDevice. 
+        /// If the graphics queue has no timestamp support the profiler is created disabled and 
+        /// records nothing.
+        /// </summary>
+        /// <param name="maxScopesPerFrame">each scope uses two queries</param>
+        GpuProfiler(uint32_t maxScopesPerFrame = 1024);
+        ~GpuProfiler();
+        /// <summary>
+        /// Collects the results of the last frame that used this slot and resets its queries. 
+        /// Call it after the slot's fence was waited and outside of any render pass.
+        /// </summary>
+        void BeginFrame(VkCommandBuffer cmd, uint32_t currentFrame);
+        /// <summary>
+        /// Marks the end of the frame's recording. Call it before submitting.
+        /// </summary>
+        void EndFrame();
+        /// <summary>
+        /// Writes the begin stamp of a scope. Returns the scope to be given to EndScope.
+        /// </summary>
+        uint32_t BeginScope(VkCommandBuffer cmd, const std::string& name);
+        /// <summary>
+        /// Writes the end stamp of a scope, when all previous commands are done.
+        /// </summary>
+        void EndScope(VkCommandBuffer cmd, uint32_t scope);
+        /// <summary>
+        /// Scopes of the latest frame whose results were collected, in the order they began.
+        /// </summary>
+        const std::vector<GpuScopeResult>& GetResults()const { return mResults; }
+        /// <summary>
+        /// Time of the first scope with that name in the latest collected frame, 
+        /// negative if there's no such scope.
+        /// </summary>
+        double GetScopeMs(const std::string& name)const;
+        bool IsEnabled()const { return mEnabled; }
+        /// <summary>
+        /// Scope around a single draw, only recorded if there's a profiler and mProfileDraws is on.
+        /// </summary>
+        static uint32_t BeginDrawScope(VkCommandBuffer cmd, const std::string& name);
+        static void EndDrawScope(VkCommandBuffer cmd, uint32_t scope);
+        /// <summary>
+        /// If true the pipelines wrap every DrawBatch in a scope named after the mesh.
+        /// It's off by default because it adds two queries per draw.
+        /// </summary>
+        bool mProfileDraws = false;
+    private:
+        struct FrameQueries {
+            VkQueryPool pool = VK_NULL_HANDLE;
+            std::vector<std::string> names;
+            uint32_t numberOfScopes = 0;
+            /// <summary>
+            /// There are stamps that were submitted and weren't read yet
+            /// </summary>
+            bool pending = false;
+        };
+        bool mEnabled = false;
+        const uint32_t mMaxScopesPerFrame;
+        /// <summary>
+        /// Nanoseconds per tick
+        /// </summary>
+        double mTimestampPeriod = 1.0;
+        /// <summary>
+        /// Only timestampValidBits of each stamp are meaningful
+        /// </summary>
+        uint64_t mTimestampMask = 0;
+        uint32_t mCurrentFrame = 0;
+        std::array<FrameQueries, MAX_FRAMES_IN_FLIGHT> mFrames;
+        std::vector<GpuScopeResult> mResults;
+        std::vector<uint64_t> mTimestamps;
+    };
+}
@@ -22,7 +22,10 @@ namespace myvk {
         Instance::gInstance = this;
         CreateInstance();
         SetupDebugMessenger(mInstance, mDebugMessager);
-        glfwCreateWindowSurface(mInstance, window, nullptr, &mSurface);
+        //headless: no window, no surface. Everything is rendered to offscreen images.
+        if (window != nullptr) {
+            glfwCreateWindowSurface(mInstance, window, nullptr, &mSurface);
+        }
         //how many devices?
         VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
         uint32_t deviceCount = 0;
@@ -43,7 +46,9 @@ namespace myvk {
     }
     Instance::~Instance()
     {
-        vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
+        if (mSurface != VK_NULL_HANDLE) {
+            vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
+        }
         DestroyDebugMessenger(mInstance, mDebugMessager);
         vkDestroyInstance(mInstance, nullptr);
     }
@@ -72,7 +77,7 @@ namespace myvk {
         if (EnableValidationLayers() && !CheckValidationLayerSupport())
             throw std::runtime_error("validation layers requested but not available");
         //Get the extensions for vk
-        const std::vector<const char*> extensions = getRequiredExtensions(EnableValidationLayers());
+        const std::vector<const char*> extensions = getRequiredExtensions(EnableValidationLayers(), mWindow == nullptr);
         //build the info struct for instance
         VkApplicationInfo appInfo = GetAppInfo();
         VkInstanceCreateInfo createInfo{};
@@ -45,6 +45,8 @@ namespace myvk {
         /// Call this ctor just once because it'll fill gInstance.
         /// Creates the VkInstance, the debug messenger, and get the physical devices.
         /// It'll not choose the physical device, that has to be done later.
+        /// If window is nullptr the instance is headless: no surface is created and
+        /// GetSurface returns VK_NULL_HANDLE.
         /// </summary>
         /// <param name="window"></param>
         Instance(GLFWwindow* window);
@@ -52,6 +54,7 @@ namespace myvk {
         ~Instance();
         VkInstance GetInstance()const { return mInstance; }
         VkSurfaceKHR GetSurface()const { return mSurface; }
+        bool IsHeadless()const { return mWindow == nullptr; }
         VkPhysicalDevice GetPhysicalDevice()const;
         /// <summary>
         /// Call this after the ctor and before GetPhysicalDevice
@@ -9,13 +9,16 @@ std::vector<VkExtensionProperties> GetExtensions()
     return extensions;
 }
 
-std::vector<const char*> getRequiredExtensions(bool enableValidationLayers)
+std::vector<const char*> getRequiredExtensions(bool enableValidationLayers, bool headless)
 {
-    uint32_t glfwExtensionsCount = 0;
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
-    std::vector<const char*> extensions(glfwExtensions, 
-        glfwExtensions + glfwExtensionsCount);
+    std::vector<const char*> extensions;
+    if (!headless) {
+        uint32_t glfwExtensionsCount = 0;
+        const char** glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
+        extensions.assign(glfwExtensions, 
+            glfwExtensions + glfwExtensionsCount);
+    }
     if (enableValidationLayers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
@@ -7,6 +7,7 @@
 /// <returns></returns>
 std::vector<VkExtensionProperties> GetExtensions();
 /// <summary>
-/// List of required extensions
+/// List of required extensions. When headless is true there is no window system, so
+/// glfw is not asked for its surface extensions.
 /// </summary>
-std::vector<const char*> getRequiredExtensions(bool enableValidationLayers);
+std::vector<const char*> getRequiredExtensions(bool enableValidationLayers, bool headless);
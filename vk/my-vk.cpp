@@ -6,6 +6,7 @@
 #include <array>
 #include <cassert>
 #include <set>
+#include <cstring>
 #include "my-vk-shaders.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -60,6 +61,26 @@ std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescriptions()
     return attributeDescriptions;
 }
 
+VkVertexInputBindingDescription GetInstanceBindingDescription()
+{
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 1;
+    bindingDescription.stride = sizeof(uint32_t);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    return bindingDescription;
+}
+
+VkVertexInputAttributeDescription GetInstanceAttributeDescription()
+{
+    //inObjectId
+    VkVertexInputAttributeDescription attributeDescription{};
+    attributeDescription.binding = 1;
+    attributeDescription.location = 3;
+    attributeDescription.format = VK_FORMAT_R32_UINT;
+    attributeDescription.offset = 0;
+    return attributeDescription;
+}
+
 void CreateHelloSampler(VkContext& ctx)
 {
     
@@ -88,6 +109,8 @@ void CreateHelloSampler(VkContext& ctx)
 }
 
 void DestroyImageViews(VkContext& ctx) {
+    if (ctx.headless)
+        return;//the views belong to the render to texture manager
     for (VkImageView& img : ctx.swapChainImageViews) {
         vkDestroyImageView(myvk::Device::gDevice->GetDevice(), img, nullptr);
     }
@@ -110,7 +133,7 @@ void CreateVkInstance(VkInstance& instance, const CustomAllocators& allocators)
     if (EnableValidationLayers() && !CheckValidationLayerSupport())
         throw std::runtime_error("validation layers requested but not available");
     //Get the extensions for vk
-    const std::vector<const char*> extensions = getRequiredExtensions(EnableValidationLayers());
+    const std::vector<const char*> extensions = getRequiredExtensions(EnableValidationLayers(), false);
     //build the info struct for instance
     VkApplicationInfo appInfo = GetAppInfo();
     VkInstanceCreateInfo createInfo{};
@@ -247,6 +270,8 @@ void CreateSwapChain(VkContext& ctx)
 
 void DestroySwapChain(VkContext& ctx)
 {
+    if (ctx.headless)
+        return;//there's no swap chain
     vkDestroySwapchainKHR(myvk::Device::gDevice->GetDevice(), ctx.swapChain, nullptr);
 }
 
@@ -477,16 +502,22 @@ void DestroyPipelineLayout(VkContext& ctx)
     vkDestroyPipelineLayout(myvk::Device::gDevice->GetDevice(), ctx.helloPipelineLayout, nullptr);
 }
 
-void CreateSwapchainRenderPass(VkContext& ctx)
+/// <summary>
+/// Creates a render pass over the swap chain image and the main depth buffer. A pass that 
+/// doesn't clear continues where the previous one left, the attachments are loaded. A pass
+/// that isn't the last keeps the depth and leaves the image to be drawn on again.
+/// </summary>
+static VkRenderPass MakeSwapchainRenderPass(const VkContext& ctx, bool clear, bool last, const char* name)
 {
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = entities::DepthBufferManager::findDepthFormat(myvk::Instance::gInstance->GetPhysicalDevice());
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+    //the depth pyramid reads what the first half of the pass drew
+    depthAttachment.storeOp = last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.initialLayout = clear ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     VkAttachmentReference depthAttachmentRef{};
     depthAttachmentRef.attachment = 1;
@@ -495,12 +526,19 @@ void CreateSwapchainRenderPass(VkContext& ctx)
     VkAttachmentDescription colorAttachment{};
     colorAttachment.format = ctx.swapChainImageFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;//clear the values to a constant at the start
+    colorAttachment.loadOp = clear ? 
+        VK_ATTACHMENT_LOAD_OP_CLEAR ://clear the values to a constant at the start
+        VK_ATTACHMENT_LOAD_OP_LOAD;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; //store the rendered result in memory for later uses
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;//not using the stencil buffer
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;//image presented in the swap chain
+    colorAttachment.initialLayout = clear ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    if (!last)
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;//another pass draws on it
+    else
+        colorAttachment.finalLayout = ctx.headless ? 
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ://headless: nothing presents it, leave it ready to be read back
+            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;//image presented in the swap chain
     //the reference to the image attachment that'll hold the result
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -530,18 +568,36 @@ void CreateSwapchainRenderPass(VkContext& ctx)
     dependency.srcAccessMask = 0;
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    if (!clear) {
+        //the loaded attachments were written by the previous pass
+        dependency.srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    }
     renderPassInfo.dependencyCount = 1;
     renderPassInfo.pDependencies = &dependency;
 
-    if (vkCreateRenderPass(myvk::Device::gDevice->GetDevice(), &renderPassInfo, nullptr, &ctx.mSwapchainRenderPass) != VK_SUCCESS) {
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(myvk::Device::gDevice->GetDevice(), &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create on screen render pass!");
     }
-    SET_NAME(ctx.mSwapchainRenderPass, VK_OBJECT_TYPE_RENDER_PASS, "main render pass");
+    SET_NAME(renderPass, VK_OBJECT_TYPE_RENDER_PASS, name);
+    return renderPass;
+}
+
+void CreateSwapchainRenderPass(VkContext& ctx)
+{
+    ctx.mSwapchainRenderPass = MakeSwapchainRenderPass(ctx, true, true, "main render pass");
+    //the halves of the on-screen pass when the occlusion culling splits it, same framebuffers
+    ctx.mSwapchainFirstPhaseRenderPass = MakeSwapchainRenderPass(ctx, true, false, "main render pass first phase");
+    ctx.mSwapchainSecondPhaseRenderPass = MakeSwapchainRenderPass(ctx, false, true, "main render pass second phase");
 }
 
 void DestroySwapchainRenderPass(VkContext& ctx)
 {
     vkDestroyRenderPass(myvk::Device::gDevice->GetDevice(), ctx.mSwapchainRenderPass, nullptr);
+    vkDestroyRenderPass(myvk::Device::gDevice->GetDevice(), ctx.mSwapchainFirstPhaseRenderPass, nullptr);
+    vkDestroyRenderPass(myvk::Device::gDevice->GetDevice(), ctx.mSwapchainSecondPhaseRenderPass, nullptr);
 }
 
 void CreateRenderToTextureRenderPass(VkContext& ctx)
@@ -695,7 +751,8 @@ void BeginRenderPass(VkRenderPass renderPass,
     VkFramebuffer framebuffer,
     VkCommandBuffer commandBuffer,
     VkExtent2D extent,
-    std::array<VkClearValue, 2> clearValues) {
+    std::array<VkClearValue, 2> clearValues,
+    VkSubpassContents contents) {
     //begin the render pass of the render pass
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -705,31 +762,58 @@ void BeginRenderPass(VkRenderPass renderPass,
     renderPassInfo.renderArea.extent = extent;
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+}
+
+void SetViewportAndScissor(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(extent.width);
+    viewport.height = static_cast<float>(extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = { 0, 0 };
+    scissor.extent = extent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void UpdateFrameGlobals(VkContext& ctx, const CameraUniformBuffer& camera) {
+    memcpy(ctx.helloCameraUniformBufferAddress[ctx.currentFrame], &camera, sizeof(CameraUniformBuffer));
 }
 
 bool BeginFrame(VkContext& ctx, uint32_t& imageIndex) {
     // check window area to deal with the degenerate case of the user dragging a border until
     // it becomes zero
-    int width = 0, height = 0;
-    glfwGetFramebufferSize(const_cast<GLFWwindow*>(myvk::Instance::gInstance->mWindow), &width, &height);
-    bool zeroArea = (width == 0) || (height == 0);
-    if (zeroArea)
-        return false;
-
+    if (!ctx.headless) {
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(const_cast<GLFWwindow*>(myvk::Instance::gInstance->mWindow), &width, &height);
+        bool zeroArea = (width == 0) || (height == 0);
+        if (zeroArea)
+            return false;
+    }
     //Fences block cpu, waiting for result. So we wait for the previous frame to finish
     vkWaitForFences(myvk::Device::gDevice->GetDevice(), 1, &ctx.inFlightFences[ctx.currentFrame], VK_TRUE, UINT64_MAX);
-    //get an image from the swap chain
-    VkResult result = vkAcquireNextImageKHR(myvk::Device::gDevice->GetDevice(), ctx.swapChain, UINT64_MAX,
-        ctx.imageAvailableSemaphores[ctx.currentFrame], //this semaphore will be signalled when the presentation is done with this image
-        VK_NULL_HANDLE, //no fence cares  
-        &imageIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        RecreateSwapChain(ctx);
-        return false;
+    if (ctx.headless) {
+        //there's only the offscreen target, nothing to acquire
+        imageIndex = 0;
     }
-    else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-        throw std::runtime_error("failed to acquire swap chain image!");
+    else {
+        //get an image from the swap chain
+        VkResult result = vkAcquireNextImageKHR(myvk::Device::gDevice->GetDevice(), ctx.swapChain, UINT64_MAX,
+            ctx.imageAvailableSemaphores[ctx.currentFrame], //this semaphore will be signalled when the presentation is done with this image
+            VK_NULL_HANDLE, //no fence cares  
+            &imageIndex);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            RecreateSwapChain(ctx);
+            return false;
+        }
+        else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("failed to acquire swap chain image!");
+        }
     }
     //if the swapchain is ok we can reset the fence
     vkResetFences(myvk::Device::gDevice->GetDevice(), 1, &ctx.inFlightFences[ctx.currentFrame]);
@@ -745,19 +829,7 @@ bool BeginFrame(VkContext& ctx, uint32_t& imageIndex) {
         throw std::runtime_error("failed to begin recording command buffer!");
     }
     //viewport and scissors are dynamic
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(ctx.swapChainExtent.width);
-    viewport.height = static_cast<float>(ctx.swapChainExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(ctx.commandBuffers[ctx.currentFrame], 0, 1, &viewport);
-
-    VkRect2D scissor{};
-    scissor.offset = { 0, 0 };
-    scissor.extent = ctx.swapChainExtent;
-    vkCmdSetScissor(ctx.commandBuffers[ctx.currentFrame], 0, 1, &scissor);
+    SetViewportAndScissor(ctx.commandBuffers[ctx.currentFrame], ctx.swapChainExtent);
     return true;
 }
 
@@ -787,11 +859,24 @@ void EndFrame(VkContext& ctx, uint32_t currentImageIndex) {
     VkSemaphore signalSemaphores[] = { ctx.renderFinishedSemaphores[ctx.currentFrame] };
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
+    if (ctx.headless) {
+        //nobody acquires or presents, so there's nothing to wait for nor to signal. The fence
+        //is enough to keep the frames in flight apart.
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.pWaitSemaphores = nullptr;
+        submitInfo.pWaitDstStageMask = nullptr;
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = nullptr;
+    }
 
     if (vkQueueSubmit(graphicsQueue, 1, 
         &submitInfo, ctx.inFlightFences[ctx.currentFrame]) != VK_SUCCESS) {
         throw std::runtime_error("failed to submit draw command buffer!");
     }
+    if (ctx.headless) {
+        ctx.currentFrame = (ctx.currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        return;
+    }
     //presentation
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -827,6 +912,8 @@ void SetMark(std::array<float, 4> color,
         __vkCmdDebugMarkerEndEXT = (PFN_vkCmdDebugMarkerEndEXT)vkGetDeviceProcAddr(myvk::Device::gDevice->GetDevice(), "vkCmdDebugMarkerEndEXT");
 
     }
+    if (__vkCmdDebugMarkerBeginEXT == nullptr)
+        return;//no debug marker extension
     VkDebugMarkerMarkerInfoEXT markerInfo = {};
     markerInfo.sType = VK_STRUCTURE_TYPE_DEBUG_MARKER_MARKER_INFO_EXT;
     markerInfo.pNext = nullptr;
@@ -838,6 +925,16 @@ void SetMark(std::array<float, 4> color,
     __vkCmdDebugMarkerBeginEXT(cmd, &markerInfo);
 }
 
+void EndMark(VkCommandBuffer cmd) {
+    if (__vkCmdDebugMarkerEndEXT == nullptr) {
+        __vkCmdDebugMarkerEndEXT = (PFN_vkCmdDebugMarkerEndEXT)vkGetDeviceProcAddr(
+            myvk::Device::gDevice->GetDevice(), "vkCmdDebugMarkerEndEXT");
+    }
+    if (__vkCmdDebugMarkerEndEXT == nullptr)
+        return;//no debug marker extension
+    __vkCmdDebugMarkerEndEXT(cmd);
+}
+
 void CreateSyncObjects(VkContext& ctx)
 {
     ctx.imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -1051,9 +1148,10 @@ void CreateDescriptorSetLayoutForObject(VkContext& ctx)
     VkDevice device = myvk::Device::gDevice->GetDevice();
     VkDescriptorSetLayoutBinding objectLayoutBinding{};
     objectLayoutBinding.binding = 0;
-    objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
     objectLayoutBinding.descriptorCount = 1;
-    objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT;
+    //the gpu culling reads the model matrices too
+    objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT|VK_SHADER_STAGE_COMPUTE_BIT;
     objectLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
     VkDescriptorSetLayoutCreateInfo objectLayoutInfo{};
@@ -1076,7 +1174,8 @@ void CreateDescriptorSetLayoutForCamera(VkContext& ctx)
     cameraLayoutBinding.binding = 0;
     cameraLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     cameraLayoutBinding.descriptorCount = 1;
-    cameraLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    //the gpu culling projects the bounds with it
+    cameraLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
     cameraLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
     VkDescriptorSetLayoutCreateInfo cameraLayoutInfo{};
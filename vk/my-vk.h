@@ -71,6 +71,15 @@ VkVertexInputBindingDescription GetBindingDescription();
 //Describes the 2 attributes that we have in the shader, inPosition and inColor
 std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescriptions();
 /// <summary>
+/// Binding 1, per-instance: the object id of each instance of an instanced draw, see 
+/// entities::InstanceBatcher.
+/// </summary>
+VkVertexInputBindingDescription GetInstanceBindingDescription();
+/// <summary>
+/// inObjectId, location 3, read from binding 1.
+/// </summary>
+VkVertexInputAttributeDescription GetInstanceAttributeDescription();
+/// <summary>
 /// Kitchen sink will all vk data.
 /// </summary>
 struct VkContext
@@ -140,6 +149,13 @@ struct VkContext
     /// </summary>
     VkRenderPass mSwapchainRenderPass = VK_NULL_HANDLE;
     /// <summary>
+    /// The on-screen pass split in two for the occlusion culling. The first clears and keeps the
+    /// depth for the depth pyramid, the second loads what the first drew and ends like 
+    /// mSwapchainRenderPass. Both are compatible with the swap chain framebuffers.
+    /// </summary>
+    VkRenderPass mSwapchainFirstPhaseRenderPass = VK_NULL_HANDLE;
+    VkRenderPass mSwapchainSecondPhaseRenderPass = VK_NULL_HANDLE;
+    /// <summary>
     /// This render pass is to render to a texture (offscreen rendering).
     /// </summary>
     VkRenderPass mRenderToTextureRenderPass = VK_NULL_HANDLE;
@@ -172,6 +188,12 @@ struct VkContext
     std::vector<VkFence> inFlightFences;
     uint32_t currentFrame = 0;
     bool framebufferResized = false;
+    /// <summary>
+    /// No window, no surface, no swap chain. The on-screen render pass renders into an offscreen
+    /// image from the RenderToTextureTargetManager that stands in for the single swap chain image,
+    /// and BeginFrame/EndFrame neither acquire nor present.
+    /// </summary>
+    bool headless = false;
 #pragma region hello_pipeline
     void DestroyCameraBuffer(VkContext& ctx);
     std::vector<VkDescriptorSet> helloCameraDescriptorSets;
@@ -273,11 +295,19 @@ void RecreateSwapChain(VkContext& ctx);
 /// </summary>
 /// <param name="renderPass"></param>
 /// <param name="clearValues"></param>
+/// <param name="contents">VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS if the draws come 
+/// from secondary command buffers</param>
 void BeginRenderPass(VkRenderPass renderPass,
     VkFramebuffer framebuffer,
     VkCommandBuffer commandBuffer,
     VkExtent2D extent,
-    std::array<VkClearValue, 2> clearValues);
+    std::array<VkClearValue, 2> clearValues,
+    VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
+/// <summary>
+/// Sets the dynamic viewport and scissor to cover the extent. BeginFrame does it for the 
+/// primary command buffer, secondary command buffers have to do it themselves.
+/// </summary>
+void SetViewportAndScissor(VkCommandBuffer commandBuffer, VkExtent2D extent);
 /// <summary>
 /// Custom vkbuffer factory to encapsulate the buffer creation process and
 /// avoid repeating boring code
@@ -338,13 +368,19 @@ void CreateDescriptorPool(VkContext& ctx);
 /// It waits for the end of the other frame if the resources it'll use are blocked
 /// by it.
 /// It returns which image it'll use. The number of the frame is in ctx.currentFrame
+/// When ctx.headless there is no swap chain and imageIndex is always 0.
 /// </summary>
 bool BeginFrame(VkContext& ctx, uint32_t& imageIndex);
 /// <summary>
 /// Ends the frame. It submits the command buffer to the queue and present
-/// the result using the swap chain
+/// the result using the swap chain. When ctx.headless it only submits.
 /// </summary>
 void EndFrame(VkContext& ctx, uint32_t currentImageIndex);
+/// <summary>
+/// Writes the data that is the same for every draw of the frame (the camera) into the current
+/// frame's uniform buffer. Call once per frame, after BeginFrame, before recording the passes.
+/// </summary>
+void UpdateFrameGlobals(VkContext& ctx, const CameraUniformBuffer& camera);
 
 void CreateHelloPipeline(VkContext& ctx);
 